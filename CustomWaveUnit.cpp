@@ -1,13 +1,14 @@
 #include "CustomWaveUnit.hpp"
 
 #include <cassert>
-#include <cmath>
 
-CustomWaveUnit::CustomWaveUnit(float sampleRate)
-  : frameStep(0), sampleRate(sampleRate),
-    enabled(0),
-    samples(CUSTOM_WAVE_SAMPLES, 0)
+CustomWaveUnit::CustomWaveUnit()
+  : frameStep(0), stepCycles(0), stepTimer(0), position(0),
+    enabled(0), playing(0), envelopeControl(0), duration(0), lengthCounterEnable(0),
+    frequencyControl(0), samples(CUSTOM_WAVE_SAMPLES, 0)
 {
+  setPeriod();
+  stepTimer = stepCycles;
 }
 
 void CustomWaveUnit::loadSamples(std::vector<uint8_t> inSamples) {
@@ -22,15 +23,22 @@ void CustomWaveUnit::loadSamples(std::vector<uint8_t> inSamples) {
 void CustomWaveUnit::reset(std::vector<uint8_t> inSamples) {
   // COMPAT make sure that the samples are loaded exactly when they
   // should be
-  time = 0.0;
+  stepTimer = stepCycles;
+  position = 0;
   loadSamples(inSamples);
-  // TODO should this also reset duration?
+  if (!duration) {
+    duration = 256;
+  }
+  playing = enabled;
 }
 
 // Write the enabled bit. Also pass in a pointer to a vector of input
 // samples, which we'll load up if we enable the unit.
 void CustomWaveUnit::write_enabled(bool in) {
   enabled = in;
+  if (!enabled) {
+    playing = 0;
+  }
 }
 
 bool CustomWaveUnit::read_enabled() {
@@ -51,10 +59,12 @@ uint8_t CustomWaveUnit::read_envelope_control() {
 
 void CustomWaveUnit::write_frequency_low(uint8_t in) {
   frequencyControl = (frequencyControl & 0xff00) + in;
+  setPeriod();
 }
 
 void CustomWaveUnit::write_frequency_high(uint8_t in) {
   frequencyControl = (frequencyControl & 0x00ff) + (in << 8);
+  setPeriod();
 }
 
 void CustomWaveUnit::write_duration_enable(bool in) {
@@ -70,33 +80,45 @@ void CustomWaveUnit::frameTick() {
   if ((frameStep % 2) == 0) { // length acts on 0, 2, 4, 6
     lengthCounterAct();
   }
+  frameStep = (frameStep + 1) % 8;
 }
 
 void CustomWaveUnit::lengthCounterAct() {
+  if (!lengthCounterEnable) {
+    return;
+  }
   if (duration) {
     duration--;
   }
   if (!duration) {
-    enabled = 0;
+    playing = 0;
   }
 }
 
-float CustomWaveUnit::period() {
-  // TODO move magic number
-  // the extra 8 sounds right, but I haven't confirmed why it's there
-  return (2048 - frequencyControl) * 8.0 * 8.0 / 4195304.0;
+void CustomWaveUnit::setPeriod() {
+  // A new frequency takes effect at the next sample.
+  stepCycles = (2048 - (frequencyControl & 0x7ff)) * CUSTOM_WAVE_STEP_CYCLES;
 }
 
-uint8_t CustomWaveUnit::tick() {
-  float prd = period();
-  float phase = fmod((time - prd) / prd, 1.0);
-  if (phase < 0.0) {
-    phase += 1.0;
+void CustomWaveUnit::advance(uint32_t cycles) {
+  if (cycles < stepTimer) {
+    stepTimer -= cycles;
+    return;
   }
+  cycles -= stepTimer;
+  position = (position + 1 + cycles / stepCycles) % CUSTOM_WAVE_SAMPLES;
+  stepTimer = stepCycles - cycles % stepCycles;
+}
 
-  int sample_i = floor(phase * CUSTOM_WAVE_SAMPLES);
+uint32_t CustomWaveUnit::nextChange() {
+  if (!playing || !envelopeControl) {
+    return UINT32_MAX;
+  }
+  return stepTimer;
+}
 
-  uint8_t out = samples.at(sample_i);
+uint8_t CustomWaveUnit::output() {
+  uint8_t out = samples[position];
 
   if (envelopeControl == 0) {
     out = 0;
@@ -104,10 +126,9 @@ uint8_t CustomWaveUnit::tick() {
     out = out >> (envelopeControl - 1);
   }
 
-  if (!enabled) {
+  if (!playing) {
     out = 0;
   }
 
-  time += 1.0 / sampleRate;
   return out;
 }
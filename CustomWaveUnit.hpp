@@ -5,12 +5,14 @@
 #include <vector>
 
 const unsigned int CUSTOM_WAVE_SAMPLES = 0x20;
+// The wave advances one sample every (2048 - frequency) * 2 cycles.
+const unsigned int CUSTOM_WAVE_STEP_CYCLES = 2;
 
 class CustomWaveUnit {
 
 public:
 
-  CustomWaveUnit(float sampleRate);
+  CustomWaveUnit();
   void loadSamples(std::vector<uint8_t>);
 
   void reset(std::vector<uint8_t>);
@@ -32,21 +34,34 @@ public:
 
   void frameTick();
 
-  uint8_t tick();
+  // Move the wave along by this many cycles, then return the level
+  // (0-15) it's at.
+  void advance(uint32_t cycles);
+  uint8_t output();
+  // Cycles until output() might change by itself: the next sample, or
+  // never (UINT32_MAX) while the channel is silent.
+  uint32_t nextChange();
 
 private:
 
-  float period();
+  void setPeriod();
 
   int frameStep;
 
   void lengthCounterAct();
 
-  const float sampleRate;
-  float time;
+  // cycles per sample of the wave, from the frequency registers
+  uint32_t stepCycles;
+  // cycles until the next sample
+  uint32_t stepTimer;
+  unsigned int position;
+  // the DAC, from NR30
   bool enabled;
+  // triggered and not yet stopped by the length counter
+  bool playing;
   uint8_t envelopeControl;
-  uint8_t duration;
+  // 1-256 length ticks left
+  uint16_t duration;
   bool lengthCounterEnable;
   uint16_t frequencyControl;
   std::vector<uint8_t> samples;
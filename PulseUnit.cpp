@@ -1,19 +1,48 @@
 #include "PulseUnit.hpp"
 
 #include <cassert>
-#include <cmath>
 #include <cstdio>
 
-PulseUnit::PulseUnit(float sampleRate)
-  : sampleRate(sampleRate),
-    dutyControl(0), enabled(0), time(0.0)
+// Which of the 8 steps are high, for each duty setting (12.5%, 25%,
+// 50%, 75%), step 0 in the low bit.
+static const uint8_t DUTY_PATTERNS[4] = {0x80, 0x81, 0xe1, 0x7e};
+
+PulseUnit::PulseUnit()
+  : frameStep(0),
+    dutyControl(0), enabled(0),
+    stepCycles(0), stepTimer(0), dutyStep(0),
+    lengthCounterEnable(0), lengthCounterValue(0),
+    frequencyControl(0), envelopeControl(0),
+    envelopeVolume(0), envelopeTimer(0),
+    sweepPeriod(0), sweepShift(0), sweepNegate(0), sweepEnabled(0),
+    sweepTimer(0), sweepShadow(0)
 {
+  setPeriod();
+  stepTimer = stepCycles;
 }
 
 void PulseUnit::reset(void) {
-  time = 0.0;
-  // TODO reset envelope, maybe also duration and sweep?
+  stepTimer = stepCycles;
   enabled = 1;
+  if (!lengthCounterValue) {
+    lengthCounterValue = 64;
+  }
+
+  envelopeVolume = envelopeControl >> 4;
+  envelopeTimer = envelopeControl & 0x7;
+
+  sweepShadow = frequencyControl & PULSE_MAX_FREQUENCY;
+  sweepTimer = sweepPeriod ? sweepPeriod : 8;
+  sweepEnabled = sweepPeriod || sweepShift;
+  if (sweepShift) {
+    // only to check for overflow; nothing changes yet
+    sweepFrequency();
+  }
+
+  // with the DAC off, a trigger doesn't turn the channel on
+  if (!(envelopeControl & 0xf8)) {
+    enabled = 0;
+  }
 }
 
 // why do some bytes get handled in one call here, but
@@ -49,8 +78,12 @@ uint8_t PulseUnit::read_duty_control(void) {
 
 
 void PulseUnit::write_envelope_control(uint8_t in) {
-  // TODO actually do something
   envelopeControl = in;
+  // Zero volume and decreasing turns the DAC off, which turns the
+  // channel off too.
+  if (!(in & 0xf8)) {
+    enabled = 0;
+  }
 }
 
 uint8_t PulseUnit::read_envelope_control(void) {
@@ -59,10 +92,12 @@ uint8_t PulseUnit::read_envelope_control(void) {
 
 void PulseUnit::write_frequency_low(uint8_t in) {
   frequencyControl = (frequencyControl & 0xff00) + in;
+  setPeriod();
 }
 
 void PulseUnit::write_frequency_high(uint8_t in) {
   frequencyControl = (frequencyControl & 0x00ff) + (in << 8);
+  setPeriod();
 }
 
 // can't read frequency
@@ -75,26 +110,9 @@ bool PulseUnit::read_duration_enable(void) {
   return lengthCounterEnable;
 }
 
-float PulseUnit::period() {
-  // TODO move magic number
-  // not sure what the 4.0 is doing here but it sounds right
-  return (2048 - frequencyControl) * 8.0 * 4.0 / 4195304.0;
-}
-
-float PulseUnit::duty() {
-  switch (dutyControl) {
-  case 0:
-    return 0.125;
-  case 1:
-    return 0.25;
-  case 2:
-    return 0.5;
-  case 3:
-    return 0.75;
-  default:
-    fprintf(stderr, "PulseUnit::duty(): Bad duty value %d\n", dutyControl);
-    exit(-1);
-  }
+void PulseUnit::setPeriod() {
+  // A new frequency takes effect at the next step.
+  stepCycles = (2048 - (frequencyControl & 0x7ff)) * PULSE_STEP_CYCLES;
 }
 
 void PulseUnit::frameTick() {
@@ -108,101 +126,73 @@ void PulseUnit::frameTick() {
   if ((frameStep % 4) == 2) { // sweep acts on 2, 6
     sweepAct();
   }
-  frameStep = (frameStep + 1) % 7;
+  frameStep = (frameStep + 1) % 8;
 }
 
-// void PulseUnit::updateSweep(bool _enabled, unsigned int _divider,
-//                             unsigned int _shift, bool _negate) {
-//   sweepEnabled = _enabled;
-//   sweepDividerReload = _divider;
-//   sweepShift = _shift;
-//   sweepNegate = _negate;
-//   sweepReset();
-// }
-
-// void PulseUnit::sweepReset() {
-//   sweepDivider = sweepDividerReload;
-//   // Note: resetting the sweep unit does not reset the divider.
-// }
-
-// void PulseUnit::updateEnvelope(bool loop, bool constant,
-//                                unsigned char timerReload) {
-//   // Note: this does not reset the envelope. reset() does that, which
-//   // is called by writing to 0x4003 or 0x4007 (length counter load,
-//   // timer high bits)
-//   envelopeLoop = loop;
-//   envelopeConstant = constant;
-//   envelopeDividerReload = timerReload;
-// }
-
+uint16_t PulseUnit::sweepFrequency() {
+  uint16_t delta = sweepShadow >> sweepShift;
+  if (sweepNegate) {
+    // can't go below zero: delta is at most the shadow itself
+    return sweepShadow - delta;
+  }
+  uint16_t out = sweepShadow + delta;
+  if (out > PULSE_MAX_FREQUENCY) {
+    enabled = 0;
+  }
+  return out;
+}
 
 void PulseUnit::sweepAct() {
-  // TODO
-}
-
-// void PulseUnit::sweepAct() {
-//   if (sweepDivider) {
-//     sweepDivider--;
-//     return;
-//   }
-//   sweepDivider = sweepDividerReload;
-//   if (sweepEnabled) {
-//     int dividerDelta = divider >> sweepShift;
-//     // TODO: If the divider would go outside [MINIMUM_DIVIDER,
-//     // MAXIMUM_DIVIDER], this should actually silence the channel
-//     // but leave the divider unchanged. Uh, it also may be that we
-//     // silence the channel before actually ticking, but as soon as
-//     // we see that on our /next/ tick we will go outside the range.
-//     if (sweepNegate) {
-//       // TODO: If we are pulse channel 1, then we are actually
-//       // adding the one's complement instead of the two's
-//       // complement, so subtract one from dividerDelta. (But what
-//       // happens if dividerDelta is zero - are we actually
-//       // increasing the divider then???)
-
-//       // dividerDelta <= divider, so this will never underflow
-//       divider -= dividerDelta;
-//     } else {
-//       // not the correct check (divider should actually never exceed
-//       // MAXIMUM_DIVIDER), but prevents overflow
-//       if (divider <= PULSE_MAXIMUM_DIVIDER) {
-//         divider += dividerDelta;
-//       }
-//     }
-//   }
-// }
+  if (sweepTimer) {
+    sweepTimer--;
+  }
+  if (sweepTimer) {
+    return;
+  }
+  // a period of 0 still counts down, as 8, but never sweeps
+  sweepTimer = sweepPeriod ? sweepPeriod : 8;
+  if (!sweepEnabled || !sweepPeriod) {
+    return;
+  }
+  uint16_t next = sweepFrequency();
+  if (next <= PULSE_MAX_FREQUENCY && sweepShift) {
+    sweepShadow = next;
+    frequencyControl = next;
+    setPeriod();
+    // and check the one after that straight away
+    sweepFrequency();
+  }
+}
 
-// TODO
 void PulseUnit::envelopeAct() {
+  unsigned int period = envelopeControl & 0x7;
+  if (!period) {
+    return;
+  }
+  if (envelopeTimer) {
+    envelopeTimer--;
+  }
+  if (envelopeTimer) {
+    return;
+  }
+  envelopeTimer = period;
+  if (envelopeControl & 0x08) {
+    if (envelopeVolume < ENVELOPE_MAX) {
+      envelopeVolume++;
+    }
+  } else if (envelopeVolume > 0) {
+    envelopeVolume--;
+  }
 }
 
-// void PulseUnit::envelopeAct() {
-//   if (envelopeDivider) {
-//     envelopeDivider--;
-//     return;
-//   }
-//   envelopeDivider = envelopeDividerReload;
-//   if (envelopeCounter > 0) {
-//     envelopeCounter--;
-//   } else if (envelopeLoop) {
-//     envelopeCounter = ENVELOPE_MAX;
-//   }
-// }
-
 unsigned char PulseUnit::envelope() {
-  // TODO
-  return envelopeControl >> 4;
+  return envelopeVolume;
 }
 
-// unsigned char PulseUnit::envelope() {
-//   unsigned char out = envelopeConstant ?
-//     envelopeDividerReload : envelopeCounter;
-//   assert((out >= 0) &&
-//          (out <= ENVELOPE_MAX));
-//   return out;
-// }
-
 void PulseUnit::lengthCounterAct() {
+  if (!lengthCounterEnable) {
+    return;
+  }
   if (lengthCounterValue) {
     lengthCounterValue--;
   }
@@ -211,14 +201,27 @@ void PulseUnit::lengthCounterAct() {
   }
 }
 
-unsigned char PulseUnit::tick()
-{
-  float prd = period();
-  float phase = fmod(((time - (0.125 * prd)) / prd), 1.0);
-  if (phase < 0.0) {
-    phase += 1.0;
+void PulseUnit::advance(uint32_t cycles) {
+  if (cycles < stepTimer) {
+    stepTimer -= cycles;
+    return;
   }
-  unsigned char out = (phase < duty()) ? envelope() : 0;
+  cycles -= stepTimer;
+  dutyStep = (dutyStep + 1 + cycles / stepCycles) & 7;
+  stepTimer = stepCycles - cycles % stepCycles;
+}
+
+uint32_t PulseUnit::nextChange() {
+  if (!enabled || !envelope()) {
+    return UINT32_MAX;
+  }
+  return stepTimer;
+}
+
+unsigned char PulseUnit::output()
+{
+  bool high = (DUTY_PATTERNS[dutyControl] >> dutyStep) & 1;
+  unsigned char out = high ? envelope() : 0;
   // if ((divider < PULSE_MINIMUM_DIVIDER) || (divider > PULSE_MAXIMUM_DIVIDER)) {
   //   out = 0;
   // }
@@ -228,7 +231,6 @@ unsigned char PulseUnit::tick()
   // if (!lengthCounterValue) {
   //   out = 0;
   // }
-  time += 1.0 / sampleRate;
   return out;
 }
 
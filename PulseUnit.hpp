@@ -3,11 +3,18 @@
 
 #include <cstdint>
 
+// The waveform advances one of its 8 steps every (2048 - frequency)
+// * 4 cycles.
+const unsigned int PULSE_STEP_CYCLES = 4;
+// The sweep turns the channel off rather than go past this.
+const uint16_t PULSE_MAX_FREQUENCY = 0x7ff;
+const unsigned char ENVELOPE_MAX = 15;
+
 class PulseUnit {
 
 public:
 
-  PulseUnit(float sampleRate);
+  PulseUnit();
   void reset();
   void setDivider(unsigned int divider);
   void setDuty(float duty);
@@ -15,16 +22,17 @@ public:
   void setLengthCounterHalt(bool halt);
   void setLengthCounter(unsigned int c);
 
-  void updateSweep(bool enabled, unsigned int divider,
-                   unsigned int shift, bool negate);
-  void sweepReset();
-
-  void updateEnvelope(bool loop, bool constant,
-                      unsigned char timerReload);
-
+  // Called by the frame sequencer at 512 Hz: length on even steps,
+  // sweep on 2 and 6, envelope on 7.
   void frameTick();
 
-  unsigned char tick();
+  // Move the waveform along by this many cycles, then return the
+  // level (0-15) it's at.
+  void advance(uint32_t cycles);
+  unsigned char output();
+  // Cycles until output() might change by itself: the next step, or
+  // never (UINT32_MAX) while the channel is silent.
+  uint32_t nextChange();
 
   void printState(void);
 
@@ -45,45 +53,46 @@ public:
 
 private:
 
-  float period();
+  void setPeriod();
   void sweepAct();
   void envelopeAct();
   void lengthCounterAct();
   unsigned char envelope();
-
-  const float sampleRate;
+  // The sweep's next frequency, turning the channel off if that
+  // overflows.
+  uint16_t sweepFrequency();
 
   int frameStep;
 
-  unsigned int divider;
   unsigned int dutyControl;
-  float duty();
   bool enabled;
-  float time;
+
+  // cycles per step of the waveform, from the frequency registers
+  uint32_t stepCycles;
+  // cycles until the next step
+  uint32_t stepTimer;
+  // 0-7
+  unsigned int dutyStep;
 
   bool lengthCounterEnable;
   int lengthCounterValue;
 
   uint16_t frequencyControl;
 
-  // placeholder to store envelope byte until envelope functionality
-  // is implemented
+  // NRx2 as written: starting volume in the top nibble, then the
+  // direction (set to get louder) and the period in 64 Hz ticks. Only
+  // read back on a trigger.
   uint8_t envelopeControl;
-
-  bool envelopeLoop;
-  bool envelopeConstant;
-  // Note: the timer reload also specifies the envelope in constant mode
-  unsigned char envelopeDividerReload;
-  unsigned char envelopeDivider;
-  unsigned char envelopeCounter;
+  unsigned char envelopeVolume;
+  unsigned char envelopeTimer;
 
   unsigned int sweepPeriod;
-  unsigned int sweepDividerReload; // TODO maybe same as period
-  unsigned int sweepDivider; // TODO implementation
   unsigned int sweepShift;
   bool sweepNegate;
-
-  bool frameCounterMode;
+  bool sweepEnabled;
+  unsigned int sweepTimer;
+  // the frequency the sweep works from, copied on a trigger
+  uint16_t sweepShadow;
 
 };
 #endif // PULSE_UNIT_H
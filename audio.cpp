@@ -1,7 +1,8 @@
+#include <algorithm>
 #include <stdexcept>
 #include <string>
 
-#include "Audio.hpp"
+#include "audio.hpp"
 
 void checkPaError(PaError err) {
   if (err != paNoError) {
@@ -19,19 +20,20 @@ static int apuCallback (const void *inputBuffer, void *outputBuffer,
   float *out = (float *) outputBuffer;
   (void) inputBuffer; /* Prevent unused variable warning. */
 
-  for(int i = 0; i < framesPerBuffer; i++) {
-    *out++ = apu->lastSampleLeft;
-    *out++ = apu->lastSampleRight;
-    apu->tick();
-  }
+  apu->fillOutput(out, framesPerBuffer);
   return 0;
 }
 
 Audio::Audio(CPU *cpu, float sampleRate)
-  : time(0), sampleRate(sampleRate), timeStep(1.0/sampleRate),
-    pulses(std::vector<PulseUnit>(N_PULSE_UNITS, PulseUnit(sampleRate))),
-    custom(sampleRate),
-    cpu(cpu)
+  : lastSampleLeft(0), lastSampleRight(0),
+    pulses(std::vector<PulseUnit>(N_PULSE_UNITS)),
+    cpu(cpu),
+    sampleRate(sampleRate),
+    unitCycles(0),
+    left(CPU_CYCLES_PER_SECOND, sampleRate),
+    right(CPU_CYCLES_PER_SECOND, sampleRate),
+    ring(AUDIO_QUEUE_FRAMES),
+    outputLeft(0), outputRight(0)
 {
 }
 
@@ -56,7 +58,7 @@ void Audio::apuInit(void) {
     2,                /* stereo output */
     paFloat32,        /* 32 bit floating point output */
     (int) sampleRate, /* sample rate */
-    256,              /* frames per buffer */
+    FRAMES_PER_BUFFER, /* frames per buffer */
     apuCallback,      /* callback */
     this);            /* pointer passed to callback */
   checkPaError(err);
@@ -66,15 +68,13 @@ void Audio::apuInit(void) {
 
 }
 
-// Computes one sample. Stores it in lastSampleLeft and
-// lastSampleRight. Automatically advances the stored time.
-void Audio::tick(void) {
+void Audio::mix(uint64_t when) {
   float outLeft = 0.0;
   float outRight = 0.0;
 
   // TODO confirm how mixing works
 
-  float channelOne = pulses[0].tick() / (15.0 * N_UNITS);
+  float channelOne = pulses[0].output() / (15.0 * N_UNITS);
   if (cpu->audio_terminals & CHANNEL_1_LEFT) {
     outLeft += channelOne;
   }
@@ -82,7 +82,7 @@ void Audio::tick(void) {
     outRight += channelOne;
   }
 
-  float channelTwo = pulses[1].tick() / (15.0 * N_UNITS);
+  float channelTwo = pulses[1].output() / (15.0 * N_UNITS);
   if (cpu->audio_terminals & CHANNEL_2_LEFT) {
     outLeft += channelTwo;
   }
@@ -90,7 +90,7 @@ void Audio::tick(void) {
     outRight += channelTwo;
   }
 
-  float channelThree = custom.tick() / (15.0 * N_UNITS);
+  float channelThree = custom.output() / (15.0 * N_UNITS);
   if (cpu->audio_terminals & CHANNEL_3_LEFT) {
     outLeft += channelThree;
   }
@@ -105,9 +105,66 @@ void Audio::tick(void) {
   float mixerRightVolume = ((cpu->audio_volume & 0x7) + 1) / 16.0;
   outRight *= mixerRightVolume;
 
-  lastSampleLeft = outLeft;
-  lastSampleRight = outRight;
-  time += timeStep;
+  if (outLeft != lastSampleLeft) {
+    left.addDelta(when, outLeft - lastSampleLeft);
+    lastSampleLeft = outLeft;
+  }
+  if (outRight != lastSampleRight) {
+    right.addDelta(when, outRight - lastSampleRight);
+    lastSampleRight = outRight;
+  }
+}
+
+void Audio::catchUp(uint64_t cycles) {
+  if (cycles <= unitCycles) {
+    return;
+  }
+  // Whatever was written since last time takes effect from there.
+  mix(unitCycles);
+  // Run the units from one level change to the next. Mostly there
+  // are only a few per sample, or none at all.
+  while (unitCycles < cycles) {
+    uint64_t step = cycles - unitCycles;
+    step = std::min<uint64_t>(step, pulses[0].nextChange());
+    step = std::min<uint64_t>(step, pulses[1].nextChange());
+    step = std::min<uint64_t>(step, custom.nextChange());
+    pulses[0].advance(step);
+    pulses[1].advance(step);
+    custom.advance(step);
+    unitCycles += step;
+    mix(unitCycles);
+  }
+
+  // Queue whatever samples that finished, a chunk at a time.
+  const int chunkFrames = 256;
+  float chunk[chunkFrames * 2];
+  size_t available = left.samplesAvailable(cycles);
+  while (available) {
+    int n = std::min<size_t>(available, chunkFrames);
+    left.read(chunk, n, 2);
+    right.read(chunk + 1, n, 2);
+    available -= n;
+    // Running ahead of the output (turbo, or just drift) drops
+    // whatever doesn't fit.
+    ring.write(chunk, n);
+  }
+}
+
+size_t Audio::queued() {
+  return ring.queued();
+}
+
+void Audio::fillOutput(float *out, unsigned long frames) {
+  unsigned long got = ring.read(out, frames);
+  if (got) {
+    outputLeft = out[got*2 - 2];
+    outputRight = out[got*2 - 1];
+  }
+  // On underrun, hold the last sample rather than clicking to 0.
+  for (unsigned long i = got; i < frames; i++) {
+    out[i*2] = outputLeft;
+    out[i*2 + 1] = outputRight;
+  }
 }
 
 void Audio::frameTick() {
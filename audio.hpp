@@ -7,14 +7,25 @@
 
 #include "portaudio.h"
 
+#include "blipbuffer.hpp"
 #include "cpu.hpp"
 #include "PulseUnit.hpp"
 #include "CustomWaveUnit.hpp"
+#include "samplering.hpp"
 
 const int N_PULSE_UNITS = 2;
 const int N_UNITS = 3;
 
 const float SAMPLE_RATE = 44100.0;
+const unsigned long FRAMES_PER_BUFFER = 256;
+
+// Samples are generated on the emulation thread, in emulated time:
+// the channels report level changes to a pair of BlipBuffers (see
+// blipbuffer.hpp), and finished samples are queued here for the
+// output callback, which only ever copies them out (see
+// samplering.hpp). This is how many stereo
+// frames the queue holds (about 190ms).
+const size_t AUDIO_QUEUE_FRAMES = 8192;
 
 // SO1 is right, SO2 is left
 const uint8_t CHANNEL_1_RIGHT = 1<<0;
@@ -33,10 +44,25 @@ public:
   Audio(CPU *cpu, float sampleRate = SAMPLE_RATE);
   ~Audio();
   void apuInit();
-  void tick();
   void frameTick();
 
+  // Generate samples up to the given master clock time. Call this
+  // before anything changes the sound state, so each sample is
+  // computed from the state at its own time.
+  void catchUp(uint64_t cycles);
+
+  // Stereo frames generated but not yet played.
+  size_t queued();
+  // Frames dropped because the queue was full, and frames the output
+  // wanted that weren't there yet. Safe from any thread.
+  uint64_t overruns() { return ring.overruns(); }
+  uint64_t underruns() { return ring.underruns(); }
+
+  // Called from the PortAudio callback
+  void fillOutput(float *out, unsigned long frames);
+
 
+  // the output level as of the last catchUp
   float lastSampleLeft;
   float lastSampleRight;
 
@@ -46,9 +72,21 @@ public:
 private:
   CPU *cpu;
 
-  float time;
   float sampleRate;
-  float timeStep;
+
+  // how far the units have been run
+  uint64_t unitCycles;
+  BlipBuffer left;
+  BlipBuffer right;
+
+  // Mix the units' current levels, and record any change in the
+  // output as happening at the given time.
+  void mix(uint64_t when);
+
+  SampleRing ring;
+  // last frame handed to the output, repeated on underrun
+  float outputLeft;
+  float outputRight;
 
   PaStream *stream;
 };
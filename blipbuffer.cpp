@@ -0,0 +1,92 @@
+#include <cmath>
+#include <cstring>
+
+#include "blipbuffer.hpp"
+
+BlipBuffer::BlipBuffer(uint32_t clockRate, uint32_t sampleRate, size_t size)
+  : clockRate(clockRate), sampleRate(sampleRate),
+    kernel(BLIP_PHASES * BLIP_TAPS), deltas(size + BLIP_TAPS, 0.0f),
+    used(0), level(0),
+    highpass(1.0 - exp(-2.0 * M_PI * BLIP_HIGHPASS_HZ / sampleRate)),
+    originCycle(0), originSample(0), samplesRead(0)
+{
+  // A Blackman-windowed sinc for each sub-sample offset, scaled so
+  // every phase adds up to exactly one: a step comes out the same
+  // height wherever it lands.
+  for (int phase = 0; phase < BLIP_PHASES; phase++) {
+    float *taps = &kernel[phase * BLIP_TAPS];
+    double offset = (double) phase / BLIP_PHASES;
+    double sum = 0;
+    for (int i = 0; i < BLIP_TAPS; i++) {
+      double x = i - (BLIP_TAPS / 2 - 1) - offset;
+      double t = 2.0 * BLIP_CUTOFF * x;
+      double sinc = (t == 0) ? 1.0 : sin(M_PI * t) / (M_PI * t);
+      double w = (x + BLIP_TAPS / 2.0) / BLIP_TAPS;
+      double window = 0.42 - 0.5 * cos(2 * M_PI * w)
+        + 0.08 * cos(4 * M_PI * w);
+      taps[i] = sinc * window;
+      sum += taps[i];
+    }
+    for (int i = 0; i < BLIP_TAPS; i++) {
+      taps[i] /= sum;
+    }
+  }
+}
+
+int64_t BlipBuffer::position(uint64_t cycle) const {
+  int64_t sinceOrigin =
+    (cycle - originCycle) * sampleRate * BLIP_PHASES / clockRate;
+  return sinceOrigin - (int64_t) (samplesRead - originSample) * BLIP_PHASES;
+}
+
+void BlipBuffer::addDelta(uint64_t cycle, float delta) {
+  int64_t pos = position(cycle);
+  if (pos < 0) {
+    pos = 0;
+  }
+  size_t sample = pos / BLIP_PHASES;
+  if (sample + BLIP_TAPS > deltas.size()) {
+    // too far ahead to hold; nothing sensible to do but drop it
+    return;
+  }
+  const float *taps = &kernel[(pos % BLIP_PHASES) * BLIP_TAPS];
+  float *out = &deltas[sample];
+  for (int i = 0; i < BLIP_TAPS; i++) {
+    out[i] += delta * taps[i];
+  }
+  if (sample + BLIP_TAPS > used) {
+    used = sample + BLIP_TAPS;
+  }
+}
+
+size_t BlipBuffer::samplesAvailable(uint64_t cycle) const {
+  // A sample is done once no step at or after `cycle` can reach it.
+  int64_t pos = position(cycle);
+  if (pos <= 0) {
+    return 0;
+  }
+  size_t n = pos / BLIP_PHASES;
+  if (n > deltas.size() - BLIP_TAPS) {
+    n = deltas.size() - BLIP_TAPS;
+  }
+  return n;
+}
+
+void BlipBuffer::read(float *out, size_t n, size_t stride) {
+  for (size_t i = 0; i < n; i++) {
+    level += deltas[i];
+    level -= level * highpass;
+    out[i * stride] = level;
+  }
+  size_t remaining = (used > n) ? used - n : 0;
+  memmove(deltas.data(), deltas.data() + n, remaining * sizeof(float));
+  memset(deltas.data() + remaining, 0, (used - remaining) * sizeof(float));
+  used = remaining;
+
+  samplesRead += n;
+  // Every second, both clocks line up exactly again.
+  while (samplesRead - originSample >= sampleRate) {
+    originSample += sampleRate;
+    originCycle += clockRate;
+  }
+}
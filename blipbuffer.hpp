@@ -0,0 +1,73 @@
+#ifndef BLIPBUFFER_H
+
+#define BLIPBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Band-limited synthesis: instead of sampling each channel at the
+// output rate (which aliases, and means evaluating every channel for
+// every sample), channels report only when their level changes, as a
+// step at a master clock time. Each step is added to the buffer as a
+// windowed sinc impulse at its exact sub-sample position, and reading
+// integrates those back into levels, a block at a time.
+//
+// Output lags the clock by BLIP_TAPS / 2 - 1 samples.
+
+// length of the impulse, in output samples
+const int BLIP_TAPS = 16;
+// sub-sample positions the impulse is tabulated at
+const int BLIP_PHASES = 64;
+// The impulse cuts off at this fraction of the output rate, a little
+// below Nyquist so the window's rolloff doesn't alias back.
+const double BLIP_CUTOFF = 0.45;
+// Reading slowly bleeds off any DC level, like the capacitor on the
+// real output does. Corner frequency in Hz.
+const double BLIP_HIGHPASS_HZ = 16.0;
+// default capacity, in output samples
+const size_t BLIP_BUFFER_SAMPLES = 4096;
+
+class BlipBuffer {
+public:
+  // Both rates have to be whole numbers of Hz.
+  BlipBuffer(uint32_t clockRate, uint32_t sampleRate,
+             size_t size = BLIP_BUFFER_SAMPLES);
+
+  // A step of `delta` at master clock time `cycle`. Steps can come in
+  // any order, but not before the samples read so far, or more than
+  // the buffer's size past them.
+  void addDelta(uint64_t cycle, float delta);
+
+  // How many samples are complete once every step up to `cycle` has
+  // been added.
+  size_t samplesAvailable(uint64_t cycle) const;
+
+  // Take n available samples, writing every stride'th float of out.
+  void read(float *out, size_t n, size_t stride = 1);
+
+private:
+  uint32_t clockRate;
+  uint32_t sampleRate;
+  // impulses, one row of BLIP_TAPS per phase
+  std::vector<float> kernel;
+  // differences between consecutive output samples, starting at the
+  // next sample to read
+  std::vector<float> deltas;
+  // how much of that any step has reached
+  size_t used;
+  float level;
+  float highpass;
+
+  // Sample positions are computed relative to a recent point where
+  // both clocks tick together, to keep the arithmetic in range.
+  uint64_t originCycle;
+  uint64_t originSample;
+  uint64_t samplesRead;
+
+  // position of `cycle`, in 1/BLIP_PHASES samples, from the next
+  // sample to read
+  int64_t position(uint64_t cycle) const;
+};
+
+#endif // #ifndef BLIPBUFFER_H
@@ -0,0 +1,133 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "capture.hpp"
+#include "cpu.hpp"
+
+FrameCapture::FrameCapture(const char *path, capture_format format,
+                           int every, Upscaler upscaler)
+  : format(format), every(every > 0 ? every : 1), counter(0),
+    encoder(SCREEN_WIDTH, SCREEN_HEIGHT),
+    upscaler(upscaler),
+    closing(0), dropped(0)
+{
+  file = strcmp(path, "-") ? fopen(path, "wb") : stdout;
+  if (!file) {
+    perror(path);
+    exit(-1);
+  }
+  if (format == CAPTURE_Y4M) {
+    // The frame rate is given as a ratio, so it can be exact.
+    fprintf(file, "YUV4MPEG2 W%d H%d F%u:%u Ip A1:1 C420jpeg\n",
+            SCREEN_WIDTH * upscaler.factor(),
+            SCREEN_HEIGHT * upscaler.factor(),
+            CPU_CYCLES_PER_SECOND, CPU_CYCLES_PER_FRAME);
+  } else if (format == CAPTURE_TILES) {
+    encoder.header(CPU_CYCLES_PER_SECOND, CPU_CYCLES_PER_FRAME, encoded);
+    fwrite(encoded.data(), encoded.size(), 1, file);
+  }
+  writer = std::thread(&FrameCapture::runWriter, this);
+}
+
+FrameCapture::~FrameCapture() {
+  finish();
+}
+
+void FrameCapture::finish() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (closing) {
+      return;
+    }
+    closing = 1;
+  }
+  ready.notify_one();
+  writer.join();
+  if (file != stdout) {
+    fclose(file);
+  } else {
+    fflush(file);
+  }
+  if (dropped) {
+    fprintf(stderr, "capture: dropped %ld frames\n", dropped);
+  }
+}
+
+void FrameCapture::frame(const uint8_t *shades) {
+  if (counter++ % every) {
+    return;
+  }
+  const size_t size = SCREEN_WIDTH * SCREEN_HEIGHT;
+  std::lock_guard<std::mutex> guard(lock);
+  if (closing || (queue.size() >= CAPTURE_QUEUE_FRAMES)) {
+    dropped++;
+    return;
+  }
+  if (spare.empty()) {
+    queue.emplace_back(size);
+  } else {
+    queue.push_back(std::move(spare.back()));
+    spare.pop_back();
+  }
+  memcpy(queue.back().data(), shades, size);
+  ready.notify_one();
+}
+
+void FrameCapture::runWriter() {
+  std::unique_lock<std::mutex> guard(lock);
+  while (1) {
+    ready.wait(guard, [this]() { return closing || !queue.empty(); });
+    if (queue.empty()) {
+      return; // closing, and nothing left
+    }
+    std::vector<uint8_t> shades = std::move(queue.front());
+    queue.pop_front();
+    guard.unlock();
+    write(shades.data());
+    guard.lock();
+    spare.push_back(std::move(shades));
+  }
+}
+
+void FrameCapture::write(const uint8_t *shades) {
+  if (format == CAPTURE_TILES) {
+    encoded.clear();
+    encoder.frame(shades, palette, encoded);
+    fwrite(encoded.data(), encoded.size(), 1, file);
+    return;
+  }
+
+  const int n = SCREEN_WIDTH * SCREEN_HEIGHT
+    * upscaler.factor() * upscaler.factor();
+  if (upscaler.factor() > 1) {
+    scaled.resize(n);
+    upscaler.apply(shades, SCREEN_WIDTH, SCREEN_HEIGHT, scaled.data());
+    shades = scaled.data();
+  }
+  if (format == CAPTURE_RAW) {
+    pixels.resize(n * 4);
+    palette.convert(shades, n, PIXEL_RGBA8888, pixels.data());
+    fwrite(pixels.data(), pixels.size(), 1, file);
+    return;
+  }
+  // The picture is all luma; chroma is a flat gray, at half
+  // resolution both ways.
+  pixels.resize(n + n / 2);
+  palette.convert(shades, n, PIXEL_GRAY8, pixels.data());
+  memset(pixels.data() + n, 128, n / 2);
+  fputs("FRAME\n", file);
+  fwrite(pixels.data(), pixels.size(), 1, file);
+}
+
+bool FrameCapture::parseFormat(const char *s, capture_format *out) {
+  if (!strcmp(s, "raw")) {
+    *out = CAPTURE_RAW;
+  } else if (!strcmp(s, "y4m")) {
+    *out = CAPTURE_Y4M;
+  } else if (!strcmp(s, "tiles")) {
+    *out = CAPTURE_TILES;
+  } else {
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,82 @@
+#ifndef CAPTURE_H
+
+#define CAPTURE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "displaypalette.hpp"
+#include "tilecodec.hpp"
+#include "upscale.hpp"
+
+// Records frames straight from the PPU's framebuffer (no GL involved)
+// to a file or pipe, for looking over long unattended runs. The
+// emulator only copies each frame into a queue; converting and
+// writing happen on a thread of their own. If the writer can't keep
+// up, frames are dropped rather than holding up emulation.
+
+enum capture_format {
+  CAPTURE_RAW, // back-to-back RGBA8888 frames
+  CAPTURE_Y4M, // YUV4MPEG2, 4:2:0, at the exact LCD refresh rate
+  CAPTURE_TILES // changed cells only; see tilecodec.hpp
+};
+// Raw and Y4M frames are SCREEN_WIDTH x SCREEN_HEIGHT times the
+// upscaler's factor. Tile recordings are always at the native size;
+// spearow-decode can scale them afterwards.
+
+// Frames waiting for the writer, at most.
+const size_t CAPTURE_QUEUE_FRAMES = 64;
+
+class FrameCapture {
+public:
+  // path "-" means stdout. Keeps one frame in `every`. Exits if the
+  // file can't be opened.
+  FrameCapture(const char *path, capture_format format, int every = 1,
+               Upscaler upscaler = Upscaler());
+  ~FrameCapture();
+
+  // Write out whatever is still queued and close the file. Frames
+  // after this are ignored.
+  void finish();
+
+  // Call with each rendered frame (SCREEN_WIDTH * SCREEN_HEIGHT
+  // shades), from one thread only. Never blocks on I/O.
+  void frame(const uint8_t *shades);
+
+  // Parse "raw", "y4m" or "tiles". Returns 0 if it's none of them.
+  static bool parseFormat(const char *, capture_format *);
+
+  DisplayPalette palette;
+
+private:
+  FILE *file;
+  capture_format format;
+  int every;
+  int counter;
+  // for CAPTURE_TILES
+  TileDeltaEncoder encoder;
+  std::vector<uint8_t> encoded;
+  // for the others
+  Upscaler upscaler;
+  std::vector<uint8_t> scaled;
+  std::vector<uint8_t> pixels;
+
+  std::mutex lock;
+  std::condition_variable ready;
+  std::deque<std::vector<uint8_t> > queue;
+  // finished buffers, reused so steady state doesn't allocate
+  std::vector<std::vector<uint8_t> > spare;
+  bool closing;
+  long dropped;
+  std::thread writer;
+
+  void runWriter();
+  void write(const uint8_t *shades);
+};
+
+#endif // #ifndef CAPTURE_H
@@ -1,7 +1,21 @@
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 #include "cpu.hpp"
+#include "mem.hpp"
+#include "triplebuffer.hpp"
+#include "capture.hpp"
+#include "tilecodec.hpp"
+#include "upscale.hpp"
+#include "framehash.hpp"
+#include "debugview.hpp"
+#include "shmvideo.hpp"
+#include "blipbuffer.hpp"
+#include "samplering.hpp"
 
 // TODO set up a proper test framework
 
@@ -112,6 +126,684 @@ int instr_daa() {
   return 1;
 }
 
+int timer_overflow() {
+  // Run NOPs with the timer at its fastest rate (16 cycles per tick)
+  // and check TIMA and DIV against the elapsed time, including one
+  // overflow.
+  CPU cpu;
+  cpu.rom.assign(0x8000, 0x00); // NOP
+  cpu.cartridge_type = 0;
+  cpu.pc = 0x100;
+  gb_mem_ptr(cpu, REG_DIVIDER).write(0);
+  gb_mem_ptr(cpu, REG_TIMER_MOD).write(0x80);
+  gb_mem_ptr(cpu, REG_TIMER_CONTROL).write(TIMER_CONTROL_ENABLE | 1);
+  uint64_t start = cpu.cycles;
+  while (cpu.cycles - start < 16 * 300) {
+    cpu.tick();
+  }
+  // 256 ticks to overflow and reload to 0x80, then 44 more
+  uint8_t tima = gb_mem_ptr(cpu, REG_TIMER_COUNT).read();
+  if (tima != 0x80 + 44) {
+    printf("Timer failed: expected TIMA %02x, got %02x\n", 0x80 + 44, tima);
+    return 0;
+  }
+  if (!(cpu.interrupts_raised & INT_TIMER)) {
+    printf("Timer failed: no interrupt after overflow\n");
+    return 0;
+  }
+  uint8_t div = gb_mem_ptr(cpu, REG_DIVIDER).read();
+  if (div != (16 * 300) / 256) {
+    printf("Timer failed: expected DIV %02x, got %02x\n",
+           (16 * 300) / 256, div);
+    return 0;
+  }
+  return 1;
+}
+
+// Park the CPU in a JR -2 loop on an otherwise all-NOP ROM, with BGP
+// at its usual 0xe4. Unless lcdc is 0, also restart the LCD with it,
+// so the next frame starts from the top.
+static void spin_with_lcd(CPU &cpu, uint8_t lcdc) {
+  cpu.rom.assign(0x8000, 0x00);
+  cpu.rom[0x100] = 0x18; // JR -2
+  cpu.rom[0x101] = 0xfe;
+  cpu.cartridge_type = 0;
+  cpu.pc = 0x100;
+  gb_mem_ptr(cpu, REG_BG_PALETTE).write(0xe4);
+  if (lcdc) {
+    gb_mem_ptr(cpu, REG_LCD_CONTROL).write(0);
+    gb_mem_ptr(cpu, REG_LCD_CONTROL).write(lcdc);
+  }
+}
+
+int lcd_stat_interrupts() {
+  // Spin in a JR loop for a frame with the hblank STAT interrupt
+  // enabled: it should fire once per visible line, and LY should
+  // cover every line.
+  CPU cpu;
+  spin_with_lcd(cpu, 0);
+  gb_mem_ptr(cpu, REG_LCD_STATUS).write(STAT_INT_HBLANK);
+  cpu.interrupts_raised = 0;
+  int n_interrupts = 0;
+  int max_ly = 0;
+  uint64_t start = cpu.cycles;
+  while (cpu.cycles - start < CPU_CYCLES_PER_FRAME) {
+    cpu.tick();
+    if (cpu.interrupts_raised & INT_LCDC) {
+      n_interrupts++;
+      cpu.interrupts_raised &= ~INT_LCDC;
+    }
+    int ly = gb_mem_ptr(cpu, REG_LCD_Y).read();
+    if (ly > max_ly) {
+      max_ly = ly;
+    }
+  }
+  if (n_interrupts != SCREEN_HEIGHT) {
+    printf("STAT failed: expected %d hblank interrupts, got %d\n",
+           SCREEN_HEIGHT, n_interrupts);
+    return 0;
+  }
+  if (max_ly != SCREEN_HEIGHT + VBLANK_HEIGHT - 1) {
+    printf("STAT failed: LY only reached %d\n", max_ly);
+    return 0;
+  }
+  return 1;
+}
+
+int scanline_palette_change(bool ppuThread) {
+  // Change BGP halfway down the frame: lines already rendered keep the
+  // old palette, and the rest get the new one. The same goes when the
+  // PPU replays the writes on its own thread.
+  CPU cpu;
+  if (ppuThread) {
+    cpu.ppu->startWorker();
+  }
+  // VRAM starts zeroed, so every pixel is color 0
+  spin_with_lcd(cpu, LCDC_DISPLAY | LCDC_BG_CHR | LCDC_BG_DISPLAY);
+  gb_mem_ptr(cpu, REG_BG_PALETTE).write(0x00); // color 0 is white
+  while (gb_mem_ptr(cpu, REG_LCD_Y).read() != SCREEN_HEIGHT / 2) {
+    cpu.tick();
+  }
+  gb_mem_ptr(cpu, REG_BG_PALETTE).write(0xff); // everything is black
+  while (gb_mem_ptr(cpu, REG_LCD_Y).read() != SCREEN_HEIGHT) {
+    cpu.tick();
+  }
+  cpu.ppu->sync();
+  const uint8_t *fb = cpu.ppu->framebuffer;
+  for (int y = 0; y < SCREEN_HEIGHT; y++) {
+    if (y == SCREEN_HEIGHT / 2) {
+      continue; // depends on where in the line the write landed
+    }
+    int expected = (y < SCREEN_HEIGHT / 2) ? 0 : 3;
+    if (fb[y * SCREEN_WIDTH] != expected) {
+      printf("Scanline failed: line %d has shade %d, expected %d\n",
+             y, fb[y * SCREEN_WIDTH], expected);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int tile_cache_update() {
+  // Writing a tile row through the bus should update both the plain
+  // and flipped decoded copies.
+  CPU cpu;
+  // tile 3, row 5: low bitplane 0b10000001, high bitplane 0b11000000
+  gb_mem_ptr(cpu, VRAM_BASE + 3*16 + 5*2).write(0x81);
+  gb_mem_ptr(cpu, VRAM_BASE + 3*16 + 5*2 + 1).write(0xc0);
+  const uint8_t expected[8] = {3, 2, 0, 0, 0, 0, 0, 1};
+  const uint8_t *row = cpu.ppu->tileRow(3, 5, 0);
+  const uint8_t *flipped = cpu.ppu->tileRow(3, 5, 1);
+  for (int x = 0; x < 8; x++) {
+    if ((row[x] != expected[x]) || (flipped[7-x] != expected[x])) {
+      printf("Tile cache failed at x=%d: got %d/%d, expected %d\n",
+             x, row[x], flipped[7-x], expected[x]);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int display_palette_formats() {
+  // Default grays: shade 0 is white and shade 3 is black in every
+  // format.
+  DisplayPalette palette;
+  const uint8_t shades[2] = {0, 3};
+  uint8_t rgba[8];
+  uint16_t rgb565[2];
+  uint8_t gray[2];
+  palette.convert(shades, 2, PIXEL_RGBA8888, rgba);
+  palette.convert(shades, 2, PIXEL_RGB565, rgb565);
+  palette.convert(shades, 2, PIXEL_GRAY8, gray);
+  const uint8_t expectedRgba[8] = {0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0xff};
+  if (memcmp(rgba, expectedRgba, sizeof(rgba)) ||
+      (rgb565[0] != 0xffff) || (rgb565[1] != 0) ||
+      (gray[0] != 0xff) || (gray[1] != 0)) {
+    printf("Palette conversion failed\n");
+    return 0;
+  }
+  return 1;
+}
+
+int frameskip_timing() {
+  // With frameskip 1, every other frame goes undrawn, but vblank
+  // still comes round on time for all of them.
+  CPU cpu;
+  cpu.pacer.setFrameskip(1);
+  spin_with_lcd(cpu, LCDC_DISPLAY | LCDC_BG_CHR | LCDC_BG_DISPLAY);
+  // Frame 0 is drawn, frame 1 skipped, frame 2 drawn.
+  const uint8_t palettes[3] = {0xff, 0x00, 0x00};
+  const uint8_t expected[3] = {3, 3, 0};
+  for (int frame = 0; frame < 3; frame++) {
+    gb_mem_ptr(cpu, REG_BG_PALETTE).write(palettes[frame]);
+    uint64_t start = cpu.cycles;
+    gb_mem_ptr(cpu, REG_INTERRUPT).write(0);
+    while (gb_mem_ptr(cpu, REG_LCD_Y).read() != SCREEN_HEIGHT) {
+      cpu.tick();
+    }
+    if (!(gb_mem_ptr(cpu, REG_INTERRUPT).read() & INT_VBLANK)) {
+      printf("Frameskip failed: no vblank in frame %d\n", frame);
+      return 0;
+    }
+    if ((frame > 0) &&
+        (cpu.cycles - start > CPU_CYCLES_PER_FRAME + 8)) {
+      printf("Frameskip failed: frame %d took %lu cycles\n",
+             frame, (unsigned long) (cpu.cycles - start));
+      return 0;
+    }
+    if (cpu.ppu->framebuffer[0] != expected[frame]) {
+      printf("Frameskip failed: frame %d has shade %d, expected %d\n",
+             frame, cpu.ppu->framebuffer[0], expected[frame]);
+      return 0;
+    }
+    while (gb_mem_ptr(cpu, REG_LCD_Y).read() == SCREEN_HEIGHT) {
+      cpu.tick();
+    }
+  }
+  return 1;
+}
+
+int frame_changed_flag() {
+  // An identical frame isn't flagged as changed; a VRAM write that
+  // changes nothing doesn't count, one that changes a byte does.
+  CPU cpu;
+  spin_with_lcd(cpu, LCDC_DISPLAY | LCDC_BG_CHR | LCDC_BG_DISPLAY);
+  const uint8_t vramWrites[4] = {0x00, 0x00, 0x00, 0xff};
+  const bool expected[4] = {1, 0, 0, 1};
+  for (int frame = 0; frame < 4; frame++) {
+    gb_mem_ptr(cpu, VRAM_BASE).write(vramWrites[frame]);
+    while (gb_mem_ptr(cpu, REG_LCD_Y).read() != SCREEN_HEIGHT) {
+      cpu.tick();
+    }
+    if (cpu.ppu->frameChanged != expected[frame]) {
+      printf("Frame changed failed: frame %d flagged %d, expected %d\n",
+             frame, cpu.ppu->frameChanged, expected[frame]);
+      return 0;
+    }
+    while (gb_mem_ptr(cpu, REG_LCD_Y).read() == SCREEN_HEIGHT) {
+      cpu.tick();
+    }
+  }
+  return 1;
+}
+
+int sprite_line_priority() {
+  // Eleven sprites on line 0: the one furthest along in OAM is over
+  // the limit and not drawn. Where two overlap, the one further left
+  // wins. A sprite behind the BG only shows over BG color 0.
+  CPU cpu;
+  gb_mem_ptr(cpu, VRAM_BASE).write(0xff); // tile 0, row 0: color 1
+  for (int i = 0; i < 16; i++) {
+    gb_mem_ptr(cpu, VRAM_BASE + 16 + i).write(0xff); // tile 1: color 3
+  }
+  cpu.lcd_control = (LCDC_DISPLAY | LCDC_BG_CHR | LCDC_BG_DISPLAY |
+                     LCDC_SPRITE_DISPLAY);
+  cpu.bg_palette = 0xe4; // color n is shade n
+  cpu.obj_palette_0 = 0xc0; // color 3 is shade 3
+  cpu.obj_palette_1 = 0x80; // color 3 is shade 2
+  const int lefts[11] = {4, 0, 20, 30, 40, 50, 60, 70, 80, 90, 100};
+  for (int i = 0; i < 11; i++) {
+    uint8_t *sprite = cpu.oam + i * SPRITE_SIZE;
+    sprite[0] = SPRITE_Y_OFFSET;
+    sprite[1] = lefts[i] + SPRITE_X_OFFSET;
+    sprite[2] = 1;
+    sprite[3] = (i == 0) ? SPRITE_PALETTE : 0;
+  }
+  cpu.oam[2 * SPRITE_SIZE + 3] = SPRITE_PRIORITY;
+  cpu.ppu->renderLine(0);
+
+  const int xs[6] = {5, 9, 21, 31, 91, 101};
+  const uint8_t expected[6] = {3, 2, 1, 3, 3, 1};
+  for (int i = 0; i < 6; i++) {
+    uint8_t shade = cpu.ppu->framebuffer[xs[i]];
+    if (shade != expected[i]) {
+      printf("Sprite priority failed: x=%d has shade %d, expected %d\n",
+             xs[i], shade, expected[i]);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int capture_y4m() {
+  // Two frames, every other one kept: a header and one frame of
+  // luma plus quarter-size chroma planes.
+  const char *path = "/tmp/spearow-capture-test.y4m";
+  uint8_t shades[SCREEN_WIDTH * SCREEN_HEIGHT];
+  memset(shades, 3, sizeof(shades));
+  FrameCapture capture(path, CAPTURE_Y4M, 2);
+  capture.frame(shades);
+  capture.frame(shades);
+  capture.finish();
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return 0;
+  }
+  char header[64];
+  bool ok = fgets(header, sizeof(header), f) &&
+    !strcmp(header, "YUV4MPEG2 W160 H144 F4194304:70224 Ip A1:1 C420jpeg\n");
+  char frame[8];
+  ok = ok && fgets(frame, sizeof(frame), f) && !strcmp(frame, "FRAME\n");
+  uint8_t luma[SCREEN_WIDTH * SCREEN_HEIGHT];
+  ok = ok && (fread(luma, sizeof(luma), 1, f) == 1) && (luma[0] == 0);
+  fseek(f, SCREEN_WIDTH * SCREEN_HEIGHT / 2, SEEK_CUR);
+  ok = ok && (fgetc(f) == EOF);
+  fclose(f);
+  remove(path);
+  return ok;
+}
+
+int tile_codec_roundtrip() {
+  // A key frame, then one changed pixel, then no change at all: the
+  // decoder gets back every frame exactly, and the unchanged frame
+  // costs just its header and flags.
+  const int n = SCREEN_WIDTH * SCREEN_HEIGHT;
+  std::vector<uint8_t> frames[3];
+  frames[0].resize(n);
+  for (int i = 0; i < n; i++) {
+    frames[0][i] = (i * 7 / 3) & 3;
+  }
+  frames[1] = frames[0];
+  frames[1][SCREEN_WIDTH * 77 + 101] ^= 1;
+  frames[2] = frames[1];
+
+  TileDeltaEncoder encoder(SCREEN_WIDTH, SCREEN_HEIGHT);
+  DisplayPalette palette;
+  std::vector<uint8_t> out;
+  encoder.header(CPU_CYCLES_PER_SECOND, CPU_CYCLES_PER_FRAME, out);
+  size_t sizes[3];
+  for (int f = 0; f < 3; f++) {
+    size_t before = out.size();
+    encoder.frame(frames[f].data(), palette, out);
+    sizes[f] = out.size() - before;
+  }
+  // flags, bitmap of 20x18 cells, one cell
+  if ((sizes[1] != TILE_FRAME_HEADER + 1 + 45 + TILE_CELL_BYTES) ||
+      (sizes[2] != TILE_FRAME_HEADER + 1)) {
+    printf("Tile codec failed: frames took %lu and %lu bytes\n",
+           (unsigned long) sizes[1], (unsigned long) sizes[2]);
+    return 0;
+  }
+
+  FILE *f = tmpfile();
+  fwrite(out.data(), out.size(), 1, f);
+  rewind(f);
+  TileDeltaDecoder decoder;
+  bool ok = decoder.open(f) && (decoder.width == SCREEN_WIDTH);
+  for (int i = 0; ok && (i < 3); i++) {
+    ok = decoder.frame() && !memcmp(decoder.shades(), frames[i].data(), n);
+  }
+  ok = ok && !decoder.frame();
+  fclose(f);
+  if (!ok) {
+    return 0;
+  }
+
+  // Damage the second frame's sync word: the decoder skips ahead to
+  // the next key frame and carries on from there.
+  for (int i = 3; i < TILE_KEY_INTERVAL; i++) {
+    encoder.frame(frames[2].data(), palette, out);
+  }
+  frames[2][0] ^= 3;
+  encoder.frame(frames[2].data(), palette, out);
+  out[sizeof(TILE_MAGIC) + 12 + sizes[0]] ^= 0xff;
+  f = tmpfile();
+  fwrite(out.data(), out.size(), 1, f);
+  rewind(f);
+  ok = decoder.open(f) && decoder.frame() &&
+    !memcmp(decoder.shades(), frames[0].data(), n) &&
+    decoder.frame() && !memcmp(decoder.shades(), frames[2].data(), n) &&
+    (decoder.resyncs == 1) && !decoder.frame();
+  fclose(f);
+  return ok;
+}
+
+int upscale_kernels_agree() {
+  // Scale2x rounds off a diagonal step...
+  const uint8_t step[4] = {0, 1,
+                           1, 1};
+  const uint8_t stepExpected[16] = {0, 0, 1, 1,
+                                    0, 1, 1, 1,
+                                    1, 1, 1, 1,
+                                    1, 1, 1, 1};
+  uint8_t stepOut[16];
+  Upscaler(UPSCALE_SCALE2X).apply(step, 2, 2, stepOut);
+  if (memcmp(stepOut, stepExpected, sizeof(stepOut))) {
+    printf("Upscale failed: scale2x corner is wrong\n");
+    return 0;
+  }
+
+  // ...and the SIMD versions match the scalar ones on a whole frame.
+  const int n = SCREEN_WIDTH * SCREEN_HEIGHT;
+  std::vector<uint8_t> frame(n);
+  for (int i = 0; i < n; i++) {
+    frame[i] = (i % 3) ? (i / 11) & 3 : (i * 13) & 3;
+  }
+  std::vector<upscale_kernels> all = available_upscale_kernels();
+  std::vector<uint8_t> expected(n * 9), out(n * 9);
+  for (size_t k = 1; k < all.size(); k++) {
+    all[0].scale3x(frame.data(), SCREEN_WIDTH, SCREEN_HEIGHT,
+                   expected.data());
+    all[k].scale3x(frame.data(), SCREEN_WIDTH, SCREEN_HEIGHT, out.data());
+    bool ok = (expected == out);
+    all[0].scale2x(frame.data(), SCREEN_WIDTH, SCREEN_HEIGHT,
+                   expected.data());
+    all[k].scale2x(frame.data(), SCREEN_WIDTH, SCREEN_HEIGHT, out.data());
+    ok = ok && !memcmp(expected.data(), out.data(), n * 4);
+    if (!ok) {
+      printf("Upscale failed: %s differs from scalar\n", all[k].name);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int frame_hashes() {
+  // The hash is XXH64, so it matches other implementations. With
+  // hashing on, frames the pacer skips are still rendered and hashed.
+  const uint8_t abc[3] = {'a', 'b', 'c'};
+  if ((frame_hash(abc, 0) != 0xef46db3751d8e999ULL) ||
+      (frame_hash(abc, 3) != 0x44bc2cf5ad770999ULL)) {
+    printf("Frame hash failed: wrong XXH64 values\n");
+    return 0;
+  }
+  CPU cpu;
+  cpu.pacer.setFrameskip(1);
+  cpu.ppu->hashFrames();
+  spin_with_lcd(cpu, LCDC_DISPLAY | LCDC_BG_CHR | LCDC_BG_DISPLAY);
+  uint64_t last = 0;
+  for (int frame = 0; frame < 4; frame++) {
+    gb_mem_ptr(cpu, VRAM_BASE).write(1 << frame);
+    while (gb_mem_ptr(cpu, REG_LCD_Y).read() != SCREEN_HEIGHT) {
+      cpu.tick();
+    }
+    uint64_t hash = cpu.ppu->frameHash;
+    if ((hash != frame_hash(cpu.ppu->framebuffer,
+                            sizeof(cpu.ppu->framebuffer))) ||
+        (hash == last) || (cpu.ppu->frameCount != (uint64_t) frame + 1)) {
+      printf("Frame hash failed: frame %d hashed %016llx\n",
+             frame, (unsigned long long) hash);
+      return 0;
+    }
+    last = hash;
+    while (gb_mem_ptr(cpu, REG_LCD_Y).read() == SCREEN_HEIGHT) {
+      cpu.tick();
+    }
+  }
+  return 1;
+}
+
+int debug_view_render() {
+  // A tile shows up in the tile view as its colors, in the BG map view
+  // through BGP, and on a flipped sprite through its OBP. The palette
+  // view shows BGP's shade for color 1.
+  static debug_snapshot snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  snapshot.vram[16] = 0x80; // tile 1, row 0: color 1 at the left
+  snapshot.vram[0x1800 + 2] = 1; // third tile of the BG map
+  snapshot.oam[2] = 1;
+  snapshot.oam[3] = SPRITE_FLIP_H | SPRITE_PALETTE;
+  snapshot.regs.lcd_control = LCDC_DISPLAY | LCDC_BG_CHR;
+  snapshot.regs.bg_palette = 0x0c; // color 1 is shade 3
+  snapshot.regs.obj_palette_1 = 0x08; // color 1 is shade 2
+  std::vector<uint8_t> image(DEBUG_VIEW_WIDTH * DEBUG_VIEW_HEIGHT);
+  DebugViews::render(snapshot, image.data());
+  const int xs[4] = {DEBUG_TILES_X + 8, DEBUG_BG_MAP_X + 16,
+                     DEBUG_SPRITES_X + 7, DEBUG_SPRITES_X + 8};
+  const int ys[4] = {0, 0, 0, DEBUG_PALETTES_Y};
+  const uint8_t expected[4] = {1, 3, 2, 3};
+  for (int i = 0; i < 4; i++) {
+    uint8_t shade = image[ys[i] * DEBUG_VIEW_WIDTH + xs[i]];
+    if (shade != expected[i]) {
+      printf("Debug view failed: (%d, %d) is %d, expected %d\n",
+             xs[i], ys[i], shade, expected[i]);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int shm_video_frames() {
+  // Frames show up in the shared memory object, and buttons pressed
+  // there show up in P1.
+  video_config config;
+  config.backend = VIDEO_SHM;
+  config.shmName = "/spearow-test";
+  CPU cpu(config);
+  ShmVideo *video = (ShmVideo *) cpu.video;
+  gb_mem_ptr(cpu, VRAM_BASE).write(0xff);
+  spin_with_lcd(cpu, LCDC_DISPLAY | LCDC_BG_CHR | LCDC_BG_DISPLAY);
+  while (gb_mem_ptr(cpu, REG_LCD_Y).read() != SCREEN_HEIGHT) {
+    cpu.tick();
+  }
+  const shm_video_header *header = video->header();
+  if (memcmp(header->magic, SHM_VIDEO_MAGIC, sizeof(header->magic)) ||
+      (header->sequence != 2) ||
+      memcmp(video->frame(), cpu.ppu->framebuffer,
+             sizeof(cpu.ppu->framebuffer))) {
+    printf("Shared memory video failed: frame not published\n");
+    return 0;
+  }
+  ((shm_video_header *) header)->buttons = JOYPAD_START;
+  gb_mem_ptr(cpu, REG_JOYPAD).write(JOYPAD_DIRECTIONS);
+  uint8_t keys = gb_mem_ptr(cpu, REG_JOYPAD).read() & 0xf;
+  if (keys != (0xf & ~JOYPAD_START)) {
+    printf("Shared memory video failed: read keys %x\n", keys);
+    return 0;
+  }
+  return 1;
+}
+
+int pulse_phase_steps() {
+  // The 50% duty waveform steps every (2048 - frequency) * 4 cycles,
+  // however the cycles are split up.
+  PulseUnit pulse;
+  pulse.write_duty_control(2);
+  pulse.write_envelope_control(0xf0);
+  pulse.write_frequency_low(0x00);
+  pulse.write_frequency_high(0x04); // 1024: 4096 cycles a step
+  pulse.reset();
+  const bool expected[8] = {1, 0, 0, 0, 0, 1, 1, 1};
+  for (int period = 0; period < 3; period++) {
+    for (int step = 0; step < 8; step++) {
+      if (!!pulse.output() != expected[step]) {
+        printf("Pulse phase failed: step %d of period %d\n", step, period);
+        return 0;
+      }
+      if (period == 0) {
+        pulse.advance(4096);
+      } else {
+        pulse.advance(1000);
+        pulse.advance(3096);
+      }
+    }
+  }
+  // a whole period at once comes back to the same step
+  pulse.advance(4096 * 8 + 1);
+  pulse.advance(4095);
+  return !pulse.output();
+}
+
+int blip_step_response() {
+  // A step comes out as a smooth rise to the new level, half way up
+  // at about the time it happened (plus the buffer's latency).
+  BlipBuffer blip(CPU_CYCLES_PER_SECOND, 44100);
+  const uint64_t stepCycle = 47554; // 500 samples in
+  blip.addDelta(stepCycle, 1.0);
+  size_t n = blip.samplesAvailable(stepCycle * 2);
+  std::vector<float> out(n);
+  blip.read(out.data(), n);
+  int middle = 500 + BLIP_TAPS / 2 - 1;
+  if ((n < 900) || (fabs(out[middle - 8]) > 0.01) ||
+      (out[middle - 2] > 0.5) || (out[middle] < 0.5) ||
+      (fabs(out[middle + 8] - 1) > 0.03)) {
+    printf("Blip step failed: %f %f %f %f\n",
+           out[middle - 8], out[middle - 2], out[middle], out[middle + 8]);
+    return 0;
+  }
+  for (size_t i = 0; i < n; i++) {
+    if ((out[i] < -0.05) || (out[i] > 1.05)) {
+      printf("Blip step failed: sample %zu is %f\n", i, out[i]);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int sample_ring_counts() {
+  // Frames come out in order across the wrap, what doesn't fit is
+  // counted as overrun, and reading past the end as underrun. Then a
+  // producer and consumer on two threads agree on every frame.
+  SampleRing ring(8);
+  float in[24], out[24];
+  for (int i = 0; i < 24; i++) {
+    in[i] = i;
+  }
+  if ((ring.write(in, 6) != 6) || (ring.read(out, 4) != 4) ||
+      (ring.write(in + 12, 6) != 6) || (ring.write(in, 2) != 0) ||
+      (ring.read(out + 8, 10) != 8) || (ring.overruns() != 2) ||
+      (ring.underruns() != 2) || (out[11] != 11) || (out[23] != 23)) {
+    printf("Sample ring failed: overruns %llu, underruns %llu\n",
+           (unsigned long long) ring.overruns(),
+           (unsigned long long) ring.underruns());
+    return 0;
+  }
+
+  SampleRing shared(64);
+  const int total = 100000;
+  std::thread producer([&shared]() {
+      float frame[2];
+      for (int i = 0; i < total; ) {
+        frame[0] = frame[1] = i;
+        if (shared.write(frame, 1)) {
+          i++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  int next = 0;
+  bool ok = 1;
+  while (next < total) {
+    float frame[2];
+    if (shared.read(frame, 1)) {
+      ok = ok && (frame[0] == next) && (frame[1] == next);
+      next++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  if (!ok) {
+    printf("Sample ring failed: frames out of order across threads\n");
+  }
+  return ok;
+}
+
+int apu_frame_sequencer() {
+  // Envelope, length and sweep all run off DIV through emulated time.
+  CPU cpu;
+  cpu.rom.assign(0x8000, 0x00); // NOP
+  cpu.cartridge_type = 0;
+  cpu.pc = 0x100;
+  PulseUnit &pulse1 = cpu.audio->pulses.at(0);
+  PulseUnit &pulse2 = cpu.audio->pulses.at(1);
+  // channel 1: volume 2, fading one step per 64 Hz tick
+  gb_mem_ptr(cpu, REG_SOUND_1_2).write(0x21);
+  gb_mem_ptr(cpu, REG_SOUND_1_4).write(0x80);
+  // channel 2: full volume, length of one 256 Hz tick
+  gb_mem_ptr(cpu, REG_SOUND_2_1).write(0x3f);
+  gb_mem_ptr(cpu, REG_SOUND_2_2).write(0xf0);
+  gb_mem_ptr(cpu, REG_SOUND_2_4).write(0xc0);
+  if ((pulse1.nextChange() == UINT32_MAX) ||
+      (pulse2.nextChange() == UINT32_MAX)) {
+    printf("Frame sequencer failed: triggered channels are silent\n");
+    return 0;
+  }
+  uint64_t start = cpu.cycles;
+  while (cpu.cycles - start < 2 * APU_FRAME_PERIOD + 4) {
+    cpu.tick();
+  }
+  if (pulse2.nextChange() != UINT32_MAX) {
+    printf("Frame sequencer failed: length didn't stop channel 2\n");
+    return 0;
+  }
+  while (cpu.cycles - start < 24 * APU_FRAME_PERIOD + 4) {
+    cpu.tick();
+  }
+  if (pulse1.nextChange() != UINT32_MAX) {
+    printf("Frame sequencer failed: envelope didn't reach zero\n");
+    return 0;
+  }
+
+  // Sweeping up from 0x500 by a half each time: 0x780 fits, but the
+  // check for the step after that overflows and stops the channel.
+  gb_mem_ptr(cpu, REG_SOUND_1_0).write(0x11);
+  gb_mem_ptr(cpu, REG_SOUND_1_2).write(0xf0);
+  gb_mem_ptr(cpu, REG_SOUND_1_3).write(0x00);
+  gb_mem_ptr(cpu, REG_SOUND_1_4).write(0x85);
+  if (pulse1.nextChange() == UINT32_MAX) {
+    printf("Frame sequencer failed: sweep stopped channel 1 too soon\n");
+    return 0;
+  }
+  start = cpu.cycles;
+  while (cpu.cycles - start < 4 * APU_FRAME_PERIOD + 4) {
+    cpu.tick();
+  }
+  if (pulse1.nextChange() != UINT32_MAX) {
+    printf("Frame sequencer failed: sweep overflow didn't stop channel 1\n");
+    return 0;
+  }
+  return 1;
+}
+
+int triple_buffer_newest() {
+  TripleBuffer frames(1);
+
+  // nothing published yet
+  if (frames.update()) {
+    return 0;
+  }
+
+  // the consumer skips straight to the newest of several frames
+  for (uint8_t i = 1; i <= 3; i++) {
+    frames.writeBuffer()[0] = i;
+    frames.publish();
+  }
+  if (!frames.update() || (frames.readBuffer()[0] != 3)) {
+    return 0;
+  }
+  // and then has nothing new until another is published
+  if (frames.update() || (frames.readBuffer()[0] != 3)) {
+    return 0;
+  }
+
+  frames.writeBuffer()[0] = 4;
+  frames.publish();
+  return frames.update() && (frames.readBuffer()[0] == 4);
+}
+
 int main() {
   std::cout << "Test register_pair_union: " <<
     (register_pair_union() ? "passed" : "failed") <<
@@ -124,5 +816,86 @@ int main() {
   std::cout << "Test instr_daa: " <<
     (daa_pass ? "passed" : "failed") <<
     "\n";
+  int timer_pass = timer_overflow();
+  std::cout << "Test timer_overflow: " <<
+    (timer_pass ? "passed" : "failed") <<
+    "\n";
+  int stat_pass = lcd_stat_interrupts();
+  std::cout << "Test lcd_stat_interrupts: " <<
+    (stat_pass ? "passed" : "failed") <<
+    "\n";
+  int scanline_pass = scanline_palette_change(0);
+  std::cout << "Test scanline_palette_change: " <<
+    (scanline_pass ? "passed" : "failed") <<
+    "\n";
+  int ppu_thread_pass = scanline_palette_change(1);
+  std::cout << "Test scanline_palette_change (PPU thread): " <<
+    (ppu_thread_pass ? "passed" : "failed") <<
+    "\n";
+  int tile_cache_pass = tile_cache_update();
+  std::cout << "Test tile_cache_update: " <<
+    (tile_cache_pass ? "passed" : "failed") <<
+    "\n";
+  int palette_pass = display_palette_formats();
+  std::cout << "Test display_palette_formats: " <<
+    (palette_pass ? "passed" : "failed") <<
+    "\n";
+  int frameskip_pass = frameskip_timing();
+  std::cout << "Test frameskip_timing: " <<
+    (frameskip_pass ? "passed" : "failed") <<
+    "\n";
+  int changed_pass = frame_changed_flag();
+  std::cout << "Test frame_changed_flag: " <<
+    (changed_pass ? "passed" : "failed") <<
+    "\n";
+  int sprite_pass = sprite_line_priority();
+  std::cout << "Test sprite_line_priority: " <<
+    (sprite_pass ? "passed" : "failed") <<
+    "\n";
+  int capture_pass = capture_y4m();
+  std::cout << "Test capture_y4m: " <<
+    (capture_pass ? "passed" : "failed") <<
+    "\n";
+  int codec_pass = tile_codec_roundtrip();
+  std::cout << "Test tile_codec_roundtrip: " <<
+    (codec_pass ? "passed" : "failed") <<
+    "\n";
+  int upscale_pass = upscale_kernels_agree();
+  std::cout << "Test upscale_kernels_agree: " <<
+    (upscale_pass ? "passed" : "failed") <<
+    "\n";
+  int hash_pass = frame_hashes();
+  std::cout << "Test frame_hashes: " <<
+    (hash_pass ? "passed" : "failed") <<
+    "\n";
+  int debug_view_pass = debug_view_render();
+  std::cout << "Test debug_view_render: " <<
+    (debug_view_pass ? "passed" : "failed") <<
+    "\n";
+  int shm_pass = shm_video_frames();
+  std::cout << "Test shm_video_frames: " <<
+    (shm_pass ? "passed" : "failed") <<
+    "\n";
+  int pulse_pass = pulse_phase_steps();
+  std::cout << "Test pulse_phase_steps: " <<
+    (pulse_pass ? "passed" : "failed") <<
+    "\n";
+  int blip_pass = blip_step_response();
+  std::cout << "Test blip_step_response: " <<
+    (blip_pass ? "passed" : "failed") <<
+    "\n";
+  int ring_pass = sample_ring_counts();
+  std::cout << "Test sample_ring_counts: " <<
+    (ring_pass ? "passed" : "failed") <<
+    "\n";
+  int sequencer_pass = apu_frame_sequencer();
+  std::cout << "Test apu_frame_sequencer: " <<
+    (sequencer_pass ? "passed" : "failed") <<
+    "\n";
+
+  int triple_pass = triple_buffer_newest();
+  std::cout << "Test triple_buffer_newest: " <<
+    (triple_pass ? "passed" : "failed") <<
+    "\n";
   return 0;
 }
@@ -3,6 +3,7 @@
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
+#include <algorithm>
 #include <fstream>
 #include <iterator>
 #include <iostream>
@@ -13,37 +14,53 @@
 #include "mem.hpp"
 #include "opcodes.hpp"
 
-CPU::CPU(bool vsync, bool displayTiles)
+CPU::CPU(const video_config &videoConfig)
   : af({.full=0}), bc({.full=0}), de({.full=0}), hl({.full=0}),
     sp(INITIAL_SP), pc(INITIAL_PC), next_pc(0),
     interrupts_raised(0),
     interrupts_enabled(0), interrupt_master_enable(0),
-    fine_divider(0),
-    timer_count(0), timer_mod(0), timer_control(0),
+    cycles(0), divider_base(0),
+    timer_base(0), timer_count(0), timer_mod(0), timer_control(0),
+    lcd_base(0), lcd_control(0), lcd_status(0),
+    scroll_y(0), scroll_x(0), lcd_y_compare(0),
+    bg_palette(0), obj_palette_0(0), obj_palette_1(0),
+    window_y(0), window_x(0),
+    serial_data(0), serial_control(0), dma_active(0),
     halted(0),
     rom_bank_low(1), ram_bank(0), mbc_mode(0),
-    cycles_to_next_frame(CPU_CYCLES_PER_FRAME),
-    cycles_to_next_scanline(CPU_CYCLES_PER_SCANLINE),
-    screen(new Screen(this, vsync, displayTiles)),
-    audio(new Audio(this))
+    ppu(new PPU(this)),
+    video(VideoSink::create(this, videoConfig)),
+    audio(new Audio(this)), capture(NULL)
 {
   install_sigint();
 
   memset(ram, 0, sizeof(ram));
   memset(highRam, 0, sizeof(highRam));
+  memset(vram, 0, sizeof(vram));
+  memset(oam, 0, sizeof(oam));
+  ppu->decodeAllTiles();
 
   audio->apuInit();
+  pacer.audio = audio;
 
   // This sets up the CPU state to what it will be after the logo and
   // chime are displayed.
 
   // TODO: emulate the logo/chime program.
   postLogoSetup();
+
+  schedule_apu_frame();
 }
 
 CPU::~CPU() {
   // restore the SIGINT handler to its old behavior
   uninstall_sigint();
+  // The audio queue is big enough that leaking it matters (the tests
+  // make a lot of CPUs). The PPU goes first: its destructor stops the
+  // worker, which may still be publishing to the video sink.
+  delete ppu;
+  delete video;
+  delete audio;
 }
 
 bool CPU::debuggerRequested;
@@ -77,6 +94,13 @@ void CPU::postLogoSetup() {
   sp = POSTLOGO_SP;
   pc = POSTLOGO_PC;
   // TODO: set up IO registers according to POSTLOGO_IOREG_INIT
+
+  // The boot program leaves the LCD on. Games tend to wait for vblank
+  // before turning it off, so it had better be running.
+  lcd_control = POSTLOGO_IOREG_INIT[REG_LCD_CONTROL - IO_BASE];
+  if (lcd_control & LCDC_DISPLAY) {
+    start_lcd();
+  }
 }
 
 void CPU::loadRom(const char *filepath) {
@@ -161,86 +185,373 @@ int CPU::load_op_and_execute() {
   return cyclesElapsed;
 }
 
-void CPU::timer_tick(int cyclesElapsed) {
-  // Process timer and divider. See
-  // http://gbdev.gg8.se/wiki/articles/Timer_Obscure_Behaviour for
-  // details. Also triggers audio frame tick.
-  int clockCyclesElapsed = cyclesElapsed * 4;
-  uint16_t newDivider = fine_divider + clockCyclesElapsed;
-  // TODO: double-speed cpu checks bit 14 instead of bit 13
-  if ((fine_divider & (1<<13)) &&
-      ~(newDivider & (1<<13))) {
-    // TODO sound clock
+uint16_t CPU::divider() {
+  return (uint16_t) (cycles - divider_base);
+}
+
+void CPU::reset_divider() {
+  // COMPAT: resetting the divider can produce a falling edge on the
+  // timer's input bit (and the sound clock's), ticking them early.
+  // See http://gbdev.gg8.se/wiki/articles/Timer_Obscure_Behaviour
+  sync_timer();
+  divider_base = cycles;
+  schedule_timer();
+  schedule_apu_frame();
+}
+
+// The timer is driven by a falling edge detector on one bit of the
+// divider, which bit depending on the lower two bits of the timer
+// control. Bit n falls every 2^(n+1) cycles, which is exactly the
+// entry in TIMER_PERIODS, so the edges are just the multiples of the
+// period counting from divider_base.
+
+// Number of timer edges in (from, to].
+static uint64_t timer_edges(uint64_t divider_base, uint64_t period,
+                            uint64_t from, uint64_t to) {
+  return ((to - divider_base) / period) - ((from - divider_base) / period);
+}
+
+uint8_t CPU::read_timer_count() {
+  if (!(timer_control & TIMER_CONTROL_ENABLE)) {
+    return timer_count;
   }
-  if (timer_control & TIMER_CONTROL_ENABLE) {
-    // Timer is driven by a falling edge detector on one bit of
-    // fine_divider. Which bit that is depends on the lower two bits of
-    // the timer control.
-    int timer_bit = 3 + ((timer_control & TIMER_CONTROL_FREQ) * 2);
-    if ((fine_divider & (1<<timer_bit)) &&
-        ~(newDivider & (1<<timer_bit))) {
-      // Tick the timer.
-
-      // COMPAT this behavior isn't exact. The interrupt is actually set
-      // four clock-cycles later, and there's some unexpected behavior
-      // with certain write timings.
-
-      timer_count++;
-      if (!timer_count) {
-        timer_count = timer_mod;
-        interrupts_raised |= INT_TIMER;
-      }
-    }
+  uint64_t period = TIMER_PERIODS[timer_control & TIMER_CONTROL_FREQ];
+  uint64_t count = timer_count +
+    timer_edges(divider_base, period, timer_base, cycles);
+  if (count > 0xff) {
+    // The overflow event should always have run by the time anyone
+    // looks, but if not, account for the reloads.
+    count = timer_mod + (count - 0x100) % (0x100 - timer_mod);
+  }
+  return (uint8_t) count;
+}
+
+void CPU::sync_timer() {
+  // Fold the elapsed ticks into timer_count before changing anything
+  // the calculation depends on.
+  timer_count = read_timer_count();
+  timer_base = cycles;
+}
+
+void CPU::write_timer_count(uint8_t to_write) {
+  // COMPAT: writes in the cycle of an overflow are supposed to cancel
+  // the reload.
+  timer_count = to_write;
+  timer_base = cycles;
+  schedule_timer();
+}
+
+void CPU::write_timer_control(uint8_t to_write) {
+  // COMPAT: disabling the timer or switching frequencies can tick it
+  // if the old input bit was set.
+  sync_timer();
+  timer_control = to_write;
+  schedule_timer();
+}
+
+void CPU::schedule_timer() {
+  // The only thing anyone can observe without reading TIMA is the
+  // overflow interrupt, so that's the only event.
+  if (!(timer_control & TIMER_CONTROL_ENABLE)) {
+    scheduler.cancel(EVENT_TIMER);
+    return;
   }
-  fine_divider = newDivider;
+  uint64_t period = TIMER_PERIODS[timer_control & TIMER_CONTROL_FREQ];
+  uint64_t first_edge =
+    timer_base + period - ((timer_base - divider_base) % period);
+  uint64_t edges_left = 0x100 - timer_count;
+  scheduler.schedule(EVENT_TIMER, first_edge + (edges_left - 1) * period);
 }
 
-void CPU::audio_frame_tick() {
+void CPU::timer_tick(uint64_t when) {
+  // TIMA just overflowed.
+
+  // COMPAT this behavior isn't exact. The interrupt is actually set
+  // four clock-cycles later, and there's some unexpected behavior
+  // with certain write timings.
+  timer_count = timer_mod;
+  timer_base = when;
+  interrupts_raised |= INT_TIMER;
+  schedule_timer();
+}
+
+void CPU::schedule_apu_frame() {
+  // TODO: double-speed cpu uses the next divider bit up
+  uint64_t phase = (cycles - divider_base) % APU_FRAME_PERIOD;
+  scheduler.schedule(EVENT_APU_FRAME, cycles + APU_FRAME_PERIOD - phase);
+}
+
+void CPU::audio_frame_tick(uint64_t when) {
+  audio->catchUp(when);
   audio->frameTick();
+  scheduler.schedule(EVENT_APU_FRAME, when + APU_FRAME_PERIOD);
+}
+
+// LCD status is a pure function of where we are in the frame.
+// COMPAT: mode 3 actually gets longer with scrolling and sprites, and
+// line 153 reports LY=0 for most of its length.
+static uint8_t lcd_mode_at(int line, int dot) {
+  if (line >= SCREEN_HEIGHT) {
+    return LCD_MODE_VBLANK;
+  }
+  if (dot < (int) MODE_2_CYCLES) {
+    return LCD_MODE_OAM;
+  }
+  if (dot < (int) (MODE_2_CYCLES + MODE_3_CYCLES)) {
+    return LCD_MODE_TRANSFER;
+  }
+  return LCD_MODE_HBLANK;
+}
+
+// The STAT interrupt is raised on rising edges of the OR of all the
+// enabled conditions, so two conditions that overlap only interrupt
+// once.
+static bool stat_line_at(uint8_t stat, uint8_t lyc, int line, int dot) {
+  uint8_t mode = lcd_mode_at(line, dot);
+  return (((stat & STAT_INT_HBLANK) && (mode == LCD_MODE_HBLANK)) ||
+          ((stat & STAT_INT_VBLANK) && (mode == LCD_MODE_VBLANK)) ||
+          ((stat & STAT_INT_OAM) && (mode == LCD_MODE_OAM)) ||
+          ((stat & STAT_INT_LYC) && (line == lyc)));
+}
+
+uint8_t CPU::read_lcd_y() {
+  if (!(lcd_control & LCDC_DISPLAY)) {
+    return 0;
+  }
+  return ((cycles - lcd_base) % CPU_CYCLES_PER_FRAME) / CPU_CYCLES_PER_SCANLINE;
+}
+
+uint8_t CPU::read_lcd_status() {
+  uint8_t out = 0x80 | (lcd_status & STAT_INT_ALL);
+  if (!(lcd_control & LCDC_DISPLAY)) {
+    // mode 0, LY stuck at 0
+    return out | ((lcd_y_compare == 0) ? STAT_LYC_EQUAL : 0);
+  }
+  uint64_t frame_pos = (cycles - lcd_base) % CPU_CYCLES_PER_FRAME;
+  int line = frame_pos / CPU_CYCLES_PER_SCANLINE;
+  int dot = frame_pos % CPU_CYCLES_PER_SCANLINE;
+  out |= lcd_mode_at(line, dot);
+  if (line == lcd_y_compare) {
+    out |= STAT_LYC_EQUAL;
+  }
+  return out;
+}
+
+bool CPU::stat_line() {
+  if (!(lcd_control & LCDC_DISPLAY)) {
+    return 0;
+  }
+  uint64_t frame_pos = (cycles - lcd_base) % CPU_CYCLES_PER_FRAME;
+  return stat_line_at(lcd_status, lcd_y_compare,
+                      frame_pos / CPU_CYCLES_PER_SCANLINE,
+                      frame_pos % CPU_CYCLES_PER_SCANLINE);
+}
+
+void CPU::write_lcd_status(uint8_t to_write) {
+  // COMPAT: on the original gameboy, any STAT write briefly enables
+  // every condition, which some games rely on (and some trip over).
+  bool was_high = stat_line();
+  lcd_status = to_write & STAT_INT_ALL;
+  if (!was_high && stat_line()) {
+    interrupts_raised |= INT_LCDC;
+  }
+  schedule_stat(cycles);
 }
 
-void CPU::display_tick(int cyclesElapsed) {
-  int clockCyclesElapsed = cyclesElapsed * 4;
-  // Also process frame timing. This will have to be much more
-  // sophisticated eventually, but this'll work for now.
-  cycles_to_next_scanline -= clockCyclesElapsed;
-  if (cycles_to_next_scanline <= 0) {
-    lcd_y = (lcd_y + 1) % (SCREEN_HEIGHT + VBLANK_HEIGHT);
-    cycles_to_next_scanline += CPU_CYCLES_PER_SCANLINE;
-    // TODO: generate INT_LCDC according to the lcd status register
-    if (lcd_y >= SCREEN_HEIGHT) {
-      // we have started vblank; request the vblank interrupt
-      interrupts_raised |= INT_VBLANK;
+void CPU::write_lcd_y_compare(uint8_t to_write) {
+  bool was_high = stat_line();
+  lcd_y_compare = to_write;
+  if (!was_high && stat_line()) {
+    interrupts_raised |= INT_LCDC;
+  }
+  schedule_stat(cycles);
+}
+
+void CPU::schedule_stat(uint64_t after) {
+  // Only schedule anything if someone is listening. The conditions
+  // can only change where the mode does (dots 0, 80 and 252 of each
+  // line), so walk forward over those boundaries looking for the
+  // first rising edge. That's at most one frame's worth, and usually
+  // the very next boundary.
+  if (!(lcd_control & LCDC_DISPLAY) || !(lcd_status & STAT_INT_ALL)) {
+    scheduler.cancel(EVENT_STAT);
+    return;
+  }
+  static const int boundaries[3] = {
+    0, MODE_2_CYCLES, MODE_2_CYCLES + MODE_3_CYCLES
+  };
+  uint64_t frame_pos = (after - lcd_base) % CPU_CYCLES_PER_FRAME;
+  uint64_t frame_start = after - frame_pos;
+  int line = frame_pos / CPU_CYCLES_PER_SCANLINE;
+  int dot = frame_pos % CPU_CYCLES_PER_SCANLINE;
+  bool high = stat_line_at(lcd_status, lcd_y_compare, line, dot);
+  // find the first boundary strictly after `after`
+  int b = 0;
+  while ((b < 3) && (boundaries[b] <= dot)) {
+    b++;
+  }
+  const int n_lines = SCREEN_HEIGHT + VBLANK_HEIGHT;
+  for (int i = 0; i <= n_lines * 3; i++) {
+    if (b == 3) {
+      b = 0;
+      line++;
+      if (line == n_lines) {
+        line = 0;
+        frame_start += CPU_CYCLES_PER_FRAME;
+      }
     }
-    if (lcd_y == 0) {
-      // we're out of vblank; unrequest vblank interrupt
-      // FIXME: this might not actually be real
-      interrupts_raised &= ~INT_VBLANK;
+    bool next_high = stat_line_at(lcd_status, lcd_y_compare,
+                                  line, boundaries[b]);
+    if (next_high && !high) {
+      scheduler.schedule(EVENT_STAT,
+                         frame_start + line * CPU_CYCLES_PER_SCANLINE
+                         + boundaries[b]);
+      return;
     }
+    high = next_high;
+    b++;
   }
-  // TODO compare lcd_y with lcd_y_compare
-  cycles_to_next_frame -= clockCyclesElapsed;
-  if (cycles_to_next_frame <= 0) {
-    screen->draw();
-    cycles_to_next_frame += CPU_CYCLES_PER_FRAME;
+  // The line never changes (e.g. only LYC is enabled and LYC is out
+  // of range).
+  scheduler.cancel(EVENT_STAT);
+}
+
+void CPU::stat_tick(uint64_t when) {
+  interrupts_raised |= INT_LCDC;
+  schedule_stat(when);
+}
+
+void CPU::display_tick(uint64_t when) {
+  // Render each line as mode 3 starts, from the registers as they are
+  // right now.
+  int line = ((when - lcd_base) % CPU_CYCLES_PER_FRAME)
+    / CPU_CYCLES_PER_SCANLINE;
+  if ((line == 0) && !pacer.shouldPresent() && !ppu->hashingFrames() &&
+      !capture) {
+    // Nobody will see this frame, so don't draw any of it. Everything
+    // the CPU can observe runs on its own events regardless. (Unless
+    // frames are being hashed or captured: which ones get skipped
+    // depends on the host, and those outputs shouldn't.)
+    scheduler.schedule(EVENT_DISPLAY, when + CPU_CYCLES_PER_FRAME);
+    return;
+  }
+  ppu->renderLine(line);
+  if (line + 1 < SCREEN_HEIGHT) {
+    scheduler.schedule(EVENT_DISPLAY, when + CPU_CYCLES_PER_SCANLINE);
+  } else {
+    // skip to the top of the next frame
+    scheduler.schedule(EVENT_DISPLAY,
+                       when + CPU_CYCLES_PER_FRAME
+                       - line * CPU_CYCLES_PER_SCANLINE);
   }
 }
 
-void CPU::tick() {
+void CPU::vblank_tick(uint64_t when) {
+  // This event keeps running while the LCD is off, so there's still
+  // something to pace emulation by.
+  if (lcd_control & LCDC_DISPLAY) {
+    // we have started vblank; request the vblank interrupt
+    interrupts_raised |= INT_VBLANK;
+    ppu->endFrame(pacer.shouldPresent());
+  }
+  video->vblank();
+  audio->catchUp(when);
+  pacer.frame();
+  scheduler.schedule(EVENT_VBLANK, when + CPU_CYCLES_PER_FRAME);
+}
+
+void CPU::start_dma() {
+  // The copy itself happens all at once (see the REG_DMA write); this
+  // just tracks how long OAM stays locked.
+  dma_active = 1;
+  scheduler.schedule(EVENT_DMA, cycles + DMA_CYCLES);
+}
+
+void CPU::dma_tick(uint64_t when) {
+  dma_active = 0;
+}
+
+void CPU::start_serial() {
+  if ((serial_control & SERIAL_CONTROL_START) &&
+      (serial_control & SERIAL_CONTROL_INTERNAL_CLOCK)) {
+    scheduler.schedule(EVENT_SERIAL, cycles + 8 * SERIAL_CYCLES_PER_BIT);
+  } else {
+    // With an external clock, nothing happens until the other side
+    // drives it, and there is never another side.
+    scheduler.cancel(EVENT_SERIAL);
+  }
+}
+
+void CPU::serial_tick(uint64_t when) {
+  // Nobody is connected, so we shift in all ones.
+  serial_data = 0xff;
+  serial_control &= ~SERIAL_CONTROL_START;
+  interrupts_raised |= INT_SERIAL;
+}
+
+void CPU::dispatch_events() {
+  while (cycles >= scheduler.next()) {
+    uint64_t when = scheduler.next();
+    switch (scheduler.pop()) {
+    case EVENT_VBLANK:
+      vblank_tick(when);
+      break;
+    case EVENT_STAT:
+      stat_tick(when);
+      break;
+    case EVENT_DISPLAY:
+      display_tick(when);
+      break;
+    case EVENT_TIMER:
+      timer_tick(when);
+      break;
+    case EVENT_APU_FRAME:
+      audio_frame_tick(when);
+      break;
+    case EVENT_DMA:
+      dma_tick(when);
+      break;
+    case EVENT_SERIAL:
+      serial_tick(when);
+      break;
+    default:
+      assert(0);
+    }
+  }
+}
+
+void CPU::step() {
   handleInterrupts();
-  int cyclesElapsed;
   if (!halted) {
-    cyclesElapsed = load_op_and_execute();
+    cycles += load_op_and_execute() * 4;
+  } else if (scheduler.next() != SCHED_NEVER) {
+    // Only an interrupt can get us out of a halt, and interrupts are
+    // only ever raised by events, so skip straight to the next one.
+    cycles = std::max(cycles + 4, scheduler.next());
   } else {
-    cyclesElapsed = 1;
+    cycles += 4;
   }
+}
 
-  timer_tick(cyclesElapsed);
+void CPU::tick() {
+  step();
+  dispatch_events();
+  check_debugger();
+}
 
-  if (lcd_control & 0x80) {
-    display_tick(cyclesElapsed);
+void CPU::run() {
+  // Nothing outside the instruction stream can change before the next
+  // event, so there's no need to look up from the CPU until then.
+  // Instructions can schedule new events, so re-read the deadline
+  // every time around.
+  while ((cycles < scheduler.next()) && !debuggerRequested) {
+    step();
   }
+  dispatch_events();
+  check_debugger();
+}
 
+void CPU::check_debugger() {
   // Now break into the debugger, if requested
 
   // FIXME: this'll currently let us recursively enter the debugger,
@@ -347,11 +658,22 @@ void CPU::disableInterrupts() {
   interrupt_master_enable = 0;
 }
 
+void CPU::start_lcd() {
+  // Call when bit 7 of REG_LCD_CONTROL goes from 0 to 1. The LCD
+  // starts at the top of a frame.
+  lcd_base = cycles;
+  scheduler.schedule(EVENT_VBLANK,
+                     cycles + SCREEN_HEIGHT * CPU_CYCLES_PER_SCANLINE);
+  schedule_stat(cycles);
+  scheduler.schedule(EVENT_DISPLAY, cycles + MODE_2_CYCLES);
+}
+
 void CPU::reset_lcd() {
-  // Call when 0 is written to bit 7 of REG_LCD_CONTROL.
-  lcd_y = 0;
-  cycles_to_next_frame = CPU_CYCLES_PER_FRAME;
-  cycles_to_next_scanline = CPU_CYCLES_PER_SCANLINE;
+  // Call when 0 is written to bit 7 of REG_LCD_CONTROL. Frames keep
+  // ticking over (see vblank_tick), just without the interrupt.
+  scheduler.schedule(EVENT_VBLANK, cycles + CPU_CYCLES_PER_FRAME);
+  scheduler.cancel(EVENT_STAT);
+  scheduler.cancel(EVENT_DISPLAY);
 }
 
 void CPU::printState() {
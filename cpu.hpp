@@ -5,8 +5,11 @@
 #include <cstdint>
 #include <vector>
 
-#include "screen.hpp"
+#include "videosink.hpp"
+#include "ppu.hpp"
 #include "audio.hpp"
+#include "scheduler.hpp"
+#include "framepacer.hpp"
 
 #ifndef __BYTE_ORDER__
 #error Unknown byte order. Set __BYTE_ORDER__ to the appropriate value.
@@ -31,9 +34,13 @@ typedef union register_pair {
 
 const unsigned int CPU_CYCLES_PER_SECOND = 4194304;
 
-// See screen.hpp for notes on this timing.
+// See ppu.hpp for notes on this timing.
 const unsigned int CPU_CYCLES_PER_FRAME = 70224;
 const unsigned int CPU_CYCLES_PER_SCANLINE = 456;
+// Each visible line spends 80 cycles in mode 2 (OAM search), then
+// about 172 in mode 3 (transfer), then the rest in mode 0 (hblank).
+const unsigned int MODE_2_CYCLES = 80;
+const unsigned int MODE_3_CYCLES = 172;
 
 const unsigned int RAM_SIZE = 0x2000;
 const unsigned int OAM_SIZE = 0xa0;
@@ -73,6 +80,18 @@ const int TIMER_PERIODS[4] = {
 const uint8_t TIMER_CONTROL_FREQ = 3;
 const uint8_t TIMER_CONTROL_ENABLE = 1<<2;
 
+// The APU frame sequencer runs at 512 Hz, off the same divider as the
+// timer.
+const unsigned int APU_FRAME_PERIOD = CPU_CYCLES_PER_SECOND / 512;
+
+// OAM DMA copies 160 bytes at one byte per machine cycle.
+const unsigned int DMA_CYCLES = OAM_SIZE * 4;
+
+// Serial transfers shift out 8 bits at 8192 Hz with the internal clock.
+const unsigned int SERIAL_CYCLES_PER_BIT = CPU_CYCLES_PER_SECOND / 8192;
+const uint8_t SERIAL_CONTROL_START = 1<<7;
+const uint8_t SERIAL_CONTROL_INTERNAL_CLOCK = 1<<0;
+
 const uint16_t CART_TYPE_ADDR = 0x0147;
 
 const uint16_t INITIAL_SP = 0xfffe;
@@ -123,18 +142,22 @@ const uint8_t POSTLOGO_IOREG_INIT[128] =
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 };
 
-class Screen;
+class PPU;
 class Audio;
+class FrameCapture;
 
 class CPU {
 public:
-  CPU(bool vsync = true, bool displayTiles = false);
+  CPU(const video_config &video = video_config());
   ~CPU();
 
   void printState();
   void printFlags(uint8_t);
 
+  // Run one instruction (plus any events that come due).
   void tick();
+  // Run instructions until the next scheduled event, then handle it.
+  void run();
 
   void loadRom(const char *);
 
@@ -170,18 +193,30 @@ public:
   uint8_t interrupts_enabled;
   bool interrupt_master_enable;
 
-  // timer/divider state
-  uint16_t fine_divider;
+  // Master clock, in clock cycles since power-on. Subsystems don't
+  // count down their own timers; they schedule events against this.
+  uint64_t cycles;
+  Scheduler scheduler;
+
+  // timer/divider state. The divider isn't stored: it's just the
+  // master clock relative to the last time DIV was reset. Likewise
+  // TIMA is only stored as of timer_base, the last time anything
+  // disturbed it; its current value is worked out when it's read.
+  uint64_t divider_base;
+  uint16_t divider();
+  uint64_t timer_base;
   uint8_t timer_count;
   uint8_t timer_mod;
   uint8_t timer_control;
 
-  // display registers
+  // display registers. LY and the read-only parts of STAT aren't
+  // stored: they follow from how long it's been since lcd_base, when
+  // the current run of frames started.
+  uint64_t lcd_base;
   uint8_t lcd_control;
-  uint8_t lcd_status;
+  uint8_t lcd_status; // only the interrupt select bits
   uint8_t scroll_y;
   uint8_t scroll_x;
-  uint8_t lcd_y;
   uint8_t lcd_y_compare;
   uint8_t bg_palette;
   uint8_t obj_palette_0;
@@ -191,14 +226,23 @@ public:
 
   uint8_t joypad_mask;
 
+  uint8_t serial_data;
+  uint8_t serial_control;
+
+  bool dma_active;
+
   uint8_t audio_volume {0};
   uint8_t audio_terminals; // maps channels to speakers
 
   // halt state
   bool halted;
 
-  Screen *screen;
+  PPU *ppu;
+  VideoSink *video;
   Audio *audio;
+  FramePacer pacer;
+  // Gets every rendered frame, if set. Not owned by the CPU.
+  FrameCapture *capture;
 
   uint8_t stack_pop();
   void stack_push(uint8_t x);
@@ -212,7 +256,19 @@ public:
   void disableInterrupts();
   void enableInterrupts();
 
+  void start_lcd();
   void reset_lcd();
+  uint8_t read_lcd_y();
+  uint8_t read_lcd_status();
+  void write_lcd_status(uint8_t);
+  void write_lcd_y_compare(uint8_t);
+
+  void reset_divider();
+  uint8_t read_timer_count();
+  void write_timer_count(uint8_t);
+  void write_timer_control(uint8_t);
+  void start_dma();
+  void start_serial();
 
   std::vector<uint8_t> rom;
 
@@ -228,14 +284,25 @@ public:
 private:
   void postLogoSetup();
 
-  int cycles_to_next_frame;
-  int cycles_to_next_scanline;
-
   void handleInterrupts();
   int load_op_and_execute();
-  void timer_tick(int cyclesElapsed);
-  void audio_frame_tick();
-  void display_tick(int cyclesElapsed);
+  void step();
+  void dispatch_events();
+  void check_debugger();
+  void schedule_apu_frame();
+  void schedule_stat(uint64_t after);
+  bool stat_line();
+  void sync_timer();
+  void schedule_timer();
+
+  // event handlers; `when` is the deadline the event was scheduled for
+  void timer_tick(uint64_t when);
+  void audio_frame_tick(uint64_t when);
+  void stat_tick(uint64_t when);
+  void display_tick(uint64_t when);
+  void vblank_tick(uint64_t when);
+  void dma_tick(uint64_t when);
+  void serial_tick(uint64_t when);
 
   // old SIGINT action handler
   static struct sigaction oldsigint;
@@ -323,7 +323,7 @@ void cmd_ascii_screen(CPU &cpu, stringstream &cmdstream) {
 }
 
 void cmd_draw(CPU &cpu, stringstream &cmdstream) {
-  cpu.screen->draw();
+  cpu.ppu->endFrame(1);
 }
 
 void cmd_disasssemble_fun(CPU &cpu, stringstream &cmdstream) {
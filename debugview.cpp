@@ -0,0 +1,147 @@
+#include <cstring>
+
+#include "debugview.hpp"
+#include "mem.hpp"
+#include "pixelkernels.hpp"
+
+DebugViews::DebugViews(int every)
+  : every(every), frames(0), visible(0),
+    snapshots(sizeof(debug_snapshot)),
+    images(DEBUG_VIEW_WIDTH * DEBUG_VIEW_HEIGHT),
+    pending(0), running(1)
+{
+  thread = std::thread(&DebugViews::run, this);
+}
+
+DebugViews::~DebugViews() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    running = 0;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+void DebugViews::vblank(const uint8_t *vram, const uint8_t *oam,
+                        const ppu_registers &regs) {
+  if (!visible || (++frames < every)) {
+    return;
+  }
+  frames = 0;
+  debug_snapshot *snapshot = (debug_snapshot *) snapshots.writeBuffer();
+  memcpy(snapshot->vram, vram, VRAM_SIZE);
+  memcpy(snapshot->oam, oam, OAM_SIZE);
+  snapshot->regs = regs;
+  snapshots.publish();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending = 1;
+  }
+  wake.notify_one();
+}
+
+void DebugViews::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (1) {
+    wake.wait(lock, [this]() { return pending || !running; });
+    if (!running) {
+      return;
+    }
+    pending = 0;
+    lock.unlock();
+    if (snapshots.update()) {
+      render(*(const debug_snapshot *) snapshots.readBuffer(),
+             images.writeBuffer());
+      images.publish();
+    }
+    lock.lock();
+  }
+}
+
+// Decode all of tile data, as colors, like the PPU's tile cache.
+static void decodeTiles(const uint8_t *vram, bool flip,
+                        uint8_t tiles[N_TILES][8][8]) {
+  best_pixel_kernels().decode_2bpp(vram, N_TILES * 8, &tiles[0][0][0], flip);
+}
+
+static void drawTile(const uint8_t tile[8][8], int rows, uint8_t palette,
+                     uint8_t *out, int x, int y) {
+  for (int r = 0; r < rows; r++) {
+    best_pixel_kernels().map_palette(tile[r], 8, palette,
+                                     out + (y + r) * DEBUG_VIEW_WIDTH + x);
+  }
+}
+
+static void drawMap(const debug_snapshot &s,
+                    const uint8_t tiles[N_TILES][8][8], bool highMap,
+                    uint8_t *out, int x) {
+  // Through BGP, with tile numbers as LCDC says to read them.
+  const uint8_t *map = s.vram + (highMap ? 0x1c00 : 0x1800);
+  bool tileSigned = !(s.regs.lcd_control & LCDC_BG_CHR);
+  for (int i = 0; i < 32 * 32; i++) {
+    int tile = map[i];
+    if (tileSigned) {
+      tile = 256 + (int8_t) tile;
+    }
+    drawTile(tiles[tile], 8, s.regs.bg_palette, out,
+             x + (i % 32) * 8, (i / 32) * 8);
+  }
+}
+
+void DebugViews::render(const debug_snapshot &s, uint8_t *out) {
+  uint8_t tiles[N_TILES][8][8];
+  uint8_t flipped[N_TILES][8][8];
+  decodeTiles(s.vram, 0, tiles);
+  decodeTiles(s.vram, 1, flipped);
+  memset(out, DEBUG_VIEW_BORDER, DEBUG_VIEW_WIDTH * DEBUG_VIEW_HEIGHT);
+
+  // Tiles show their colors as the matching shades.
+  for (int tile = 0; tile < N_TILES; tile++) {
+    drawTile(tiles[tile], 8, 0xe4, out,
+             DEBUG_TILES_X + (tile % 16) * 8, (tile / 16) * 8);
+  }
+
+  drawMap(s, tiles, s.regs.lcd_control & LCDC_BG_CODE, out,
+          DEBUG_BG_MAP_X);
+  drawMap(s, tiles, s.regs.lcd_control & LCDC_WINDOW_CODE, out,
+          DEBUG_WINDOW_MAP_X);
+
+  // Sprites, through their own palettes, flipped as they'd be drawn.
+  // Color 0 is transparent, so it shows as the lightest shade.
+  bool tall = s.regs.lcd_control & LCDC_SPRITE_SIZE;
+  for (int i = 0; i < OAM_N_SPRITES; i++) {
+    const uint8_t *sprite = s.oam + i * SPRITE_SIZE;
+    uint8_t flags = sprite[3];
+    uint8_t palette = ((flags & SPRITE_PALETTE) ?
+                       s.regs.obj_palette_1 : s.regs.obj_palette_0) & 0xfc;
+    int x = DEBUG_SPRITES_X + (i % 8) * 8;
+    int y = (i / 8) * 16;
+    int rows = tall ? 16 : 8;
+    for (int r = 0; r < 16; r++) {
+      uint8_t *row = out + (y + r) * DEBUG_VIEW_WIDTH + x;
+      if (r >= rows) {
+        memset(row, 0, 8);
+        continue;
+      }
+      int ty = (flags & SPRITE_FLIP_V) ? rows - 1 - r : r;
+      int tile = tall ? ((sprite[2] & 0xfe) + ty / 8) : sprite[2];
+      const uint8_t (*decoded)[8][8] =
+        (flags & SPRITE_FLIP_H) ? flipped : tiles;
+      best_pixel_kernels().map_palette(decoded[tile][ty % 8], 8, palette,
+                                       row);
+    }
+  }
+
+  const uint8_t palettes[3] = {
+    s.regs.bg_palette, s.regs.obj_palette_0, s.regs.obj_palette_1
+  };
+  for (int p = 0; p < 3; p++) {
+    for (int color = 0; color < 4; color++) {
+      uint8_t shade = (palettes[p] >> (color * 2)) & 3;
+      for (int r = 0; r < 8; r++) {
+        memset(out + (DEBUG_PALETTES_Y + p * 8 + r) * DEBUG_VIEW_WIDTH
+               + DEBUG_SPRITES_X + color * 8, shade, 8);
+      }
+    }
+  }
+}
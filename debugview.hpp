@@ -0,0 +1,92 @@
+#ifndef DEBUGVIEW_H
+
+#define DEBUGVIEW_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "triplebuffer.hpp"
+
+// Debug views of what the PPU draws from: all the tiles, both tile
+// maps (the one the BG uses and the one the window uses), the sprites
+// in OAM and the three palettes. They're laid out side by side in one
+// image of shades, like a frame:
+//
+//   tiles | BG map | window map | sprites
+//                              | palettes
+//
+// The emulation thread only copies VRAM, OAM and the registers at
+// vblank, every few frames, and only while somebody's looking. A
+// thread of its own turns that into the image.
+
+// 16 x 24 tiles
+const int DEBUG_TILES_X = 0;
+const int DEBUG_TILES_WIDTH = 16 * 8;
+const int DEBUG_TILES_HEIGHT = 24 * 8;
+const int DEBUG_MAP_SIZE = 32 * 8;
+const int DEBUG_BG_MAP_X = DEBUG_TILES_X + DEBUG_TILES_WIDTH + 8;
+const int DEBUG_WINDOW_MAP_X = DEBUG_BG_MAP_X + DEBUG_MAP_SIZE + 8;
+// 8 x 5 sprites, each in an 8x16 cell
+const int DEBUG_SPRITES_X = DEBUG_WINDOW_MAP_X + DEBUG_MAP_SIZE + 8;
+const int DEBUG_SPRITES_WIDTH = 8 * 8;
+const int DEBUG_SPRITES_HEIGHT = 5 * 16;
+// BGP, OBP0, OBP1: a row of 4 8x8 swatches each
+const int DEBUG_PALETTES_Y = DEBUG_SPRITES_HEIGHT + 8;
+const int DEBUG_VIEW_WIDTH = DEBUG_SPRITES_X + DEBUG_SPRITES_WIDTH;
+const int DEBUG_VIEW_HEIGHT = DEBUG_MAP_SIZE;
+// what the gaps between views are filled with
+const uint8_t DEBUG_VIEW_BORDER = 3;
+
+// By default, refresh at 15 Hz.
+const int DEBUG_VIEW_EVERY = 4;
+
+struct debug_snapshot {
+  uint8_t vram[VRAM_SIZE];
+  uint8_t oam[OAM_SIZE];
+  ppu_registers regs;
+};
+
+class DebugViews {
+public:
+  // Refresh every `every` frames.
+  DebugViews(int every = DEBUG_VIEW_EVERY);
+  ~DebugViews();
+
+  // Emulation thread, at every vblank. Does nothing unless the views
+  // are visible and due for a refresh.
+  void vblank(const uint8_t *vram, const uint8_t *oam,
+              const ppu_registers &regs);
+
+  // Presentation thread: say whether the views are on screen, and
+  // pick up the newest image (DEBUG_VIEW_WIDTH * DEBUG_VIEW_HEIGHT
+  // shades). update() returns 0 if there isn't a new one.
+  void setVisible(bool v) { visible = v; }
+  bool update() { return images.update(); }
+  const uint8_t *image() const { return images.readBuffer(); }
+
+  // Draw the views of a snapshot into `out`.
+  static void render(const debug_snapshot &snapshot, uint8_t *out);
+
+private:
+  int every;
+  int frames;
+  std::atomic<bool> visible;
+
+  TripleBuffer snapshots;
+  TripleBuffer images;
+
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool pending;
+  bool running;
+
+  void run();
+};
+
+#endif // #ifndef DEBUGVIEW_H
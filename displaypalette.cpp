@@ -0,0 +1,57 @@
+#include <cstring>
+
+#include "displaypalette.hpp"
+
+int pixel_format_bytes(pixel_format format) {
+  switch (format) {
+  case PIXEL_RGBA8888:
+    return 4;
+  case PIXEL_RGB565:
+    return 2;
+  case PIXEL_GRAY8:
+  default:
+    return 1;
+  }
+}
+
+DisplayPalette::DisplayPalette() {
+  for (int shade = 0; shade < 4; shade++) {
+    uint8_t level = 0xff - shade * 0x55;
+    setShade(shade, level, level, level);
+  }
+}
+
+void DisplayPalette::setShade(int shade, uint8_t r, uint8_t g, uint8_t b) {
+  const uint8_t bytes[4] = {r, g, b, 0xff};
+  memcpy(&rgba[shade], bytes, sizeof(bytes));
+  rgb565[shade] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+  // Rec. 601 luma, in fixed point
+  gray[shade] = (r * 77 + g * 150 + b * 29) >> 8;
+}
+
+void DisplayPalette::convert(const uint8_t *shades, int n,
+                             pixel_format format, void *out) const {
+  switch (format) {
+  case PIXEL_RGBA8888: {
+    uint32_t *pixels = (uint32_t *) out;
+    for (int i = 0; i < n; i++) {
+      pixels[i] = rgba[shades[i] & 3];
+    }
+    break;
+  }
+  case PIXEL_RGB565: {
+    uint16_t *pixels = (uint16_t *) out;
+    for (int i = 0; i < n; i++) {
+      pixels[i] = rgb565[shades[i] & 3];
+    }
+    break;
+  }
+  case PIXEL_GRAY8: {
+    uint8_t *pixels = (uint8_t *) out;
+    for (int i = 0; i < n; i++) {
+      pixels[i] = gray[shades[i] & 3];
+    }
+    break;
+  }
+  }
+}
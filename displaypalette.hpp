@@ -0,0 +1,40 @@
+#ifndef DISPLAYPALETTE_H
+
+#define DISPLAYPALETTE_H
+
+#include <cstdint>
+
+// The PPU produces one shade per pixel, 0 (lightest) to 3 (darkest),
+// which is all the hardware itself knows about. What those shades
+// look like, and what pixel format they end up in, is up to whoever
+// is displaying or recording the frame: they convert through one of
+// these, and only when they actually need the pixels.
+
+enum pixel_format {
+  PIXEL_RGBA8888, // bytes R, G, B, A
+  PIXEL_RGB565, // native-endian uint16_t, red in the high bits
+  PIXEL_GRAY8
+};
+
+int pixel_format_bytes(pixel_format);
+
+class DisplayPalette {
+public:
+  // Defaults to evenly spaced grays.
+  DisplayPalette();
+
+  void setShade(int shade, uint8_t r, uint8_t g, uint8_t b);
+
+  // Convert n shades to the given format. out needs room for
+  // n * pixel_format_bytes(format) bytes.
+  void convert(const uint8_t *shades, int n, pixel_format format,
+               void *out) const;
+
+private:
+  // lookup tables, indexed by shade
+  uint32_t rgba[4]; // already in memory order
+  uint16_t rgb565[4];
+  uint8_t gray[4];
+};
+
+#endif // #ifndef DISPLAYPALETTE_H
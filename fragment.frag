@@ -9,6 +9,4 @@ out vec4 outColor;
 void main()
 {
   outColor = texture(tex, uv);
-  outColor.g = outColor.r;
-  outColor.b = outColor.r;
 }
@@ -0,0 +1,12 @@
+#ifndef FRAMEHASH_H
+
+#define FRAMEHASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// A fast non-cryptographic hash for comparing frames: XXH64, so
+// hashes can be checked against any other xxHash implementation.
+uint64_t frame_hash(const uint8_t *data, size_t n, uint64_t seed = 0);
+
+#endif // #ifndef FRAMEHASH_H
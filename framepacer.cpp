@@ -0,0 +1,252 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "framepacer.hpp"
+#include "cpu.hpp"
+#include "audio.hpp"
+
+FramePacer::FramePacer()
+  : audio(NULL), reportStats(0),
+    speedIndex(PACER_NORMAL_SPEED), syncMode(PACE_VIDEO), present(1),
+    frameskip(0), skipped(0), turboReturnSpeed(PACER_NORMAL_SPEED),
+    lastSpeedIndex(PACER_NORMAL_SPEED),
+    deadline(clock::now()), lastPresent(clock::now()),
+    statFrames(0), statLateFrames(0), statDroppedFrames(0),
+    statSkippedFrames(0),
+    statLatenessSumUs(0), statLatenessMaxUs(0),
+    statStart(clock::now())
+{
+}
+
+FramePacer::clock::duration FramePacer::framePeriod(int index) {
+  std::chrono::duration<double> period(
+    (double) CPU_CYCLES_PER_FRAME / CPU_CYCLES_PER_SECOND
+    / PACER_SPEEDS[index]);
+  return std::chrono::duration_cast<clock::duration>(period);
+}
+
+void FramePacer::frame() {
+  bool behind = pace();
+
+  if (frameskip == PACER_FRAMESKIP_AUTO) {
+    if (behind && (skipped < PACER_MAX_FRAMESKIP)) {
+      present = 0;
+    }
+  } else if (skipped < frameskip) {
+    present = 0;
+  }
+
+  if (present) {
+    skipped = 0;
+  } else {
+    skipped++;
+    statSkippedFrames++;
+  }
+}
+
+bool FramePacer::pace() {
+  int index = speedIndex.load(std::memory_order_relaxed);
+
+  if ((syncMode == PACE_AUDIO) && audio && (index == PACER_NORMAL_SPEED)) {
+    // This drops frames of its own when it falls behind.
+    waitForAudio();
+    return 0;
+  }
+
+  clock::time_point now = clock::now();
+
+  // Above normal speed we make frames faster than any display shows
+  // them, so only present about as often as it refreshes.
+  if (index > PACER_NORMAL_SPEED) {
+    present = (now - lastPresent >= PACER_PRESENT_INTERVAL);
+  } else {
+    present = 1;
+  }
+  if (present) {
+    lastPresent = now;
+  }
+
+  if ((index == PACER_UNCAPPED) || (index != lastSpeedIndex)) {
+    // Nothing to wait for, or the schedule we were keeping no longer
+    // applies. Either way, start over from now.
+    lastSpeedIndex = index;
+    deadline = now;
+    if (index == PACER_UNCAPPED) {
+      return 0;
+    }
+  }
+
+  clock::duration period = framePeriod(index);
+  deadline += period;
+  bool behind = (now > deadline);
+
+  if (now > deadline + PACER_MAX_FRAMES_BEHIND * period) {
+    deadline = now;
+    statLateFrames++;
+  } else {
+    if (now < deadline - PACER_SPIN_MARGIN) {
+      std::this_thread::sleep_until(deadline - PACER_SPIN_MARGIN);
+    }
+    while ((now = clock::now()) < deadline) {
+      // spin
+    }
+  }
+
+  double latenessUs =
+    std::chrono::duration<double, std::micro>(now - deadline).count();
+  statFrames++;
+  statLatenessSumUs += latenessUs;
+  if (latenessUs > statLatenessMaxUs) {
+    statLatenessMaxUs = latenessUs;
+  }
+  if (reportStats && (statFrames >= PACER_REPORT_FRAMES)) {
+    printStats();
+  }
+  return behind;
+}
+
+void FramePacer::waitForAudio() {
+  size_t queued = audio->queued();
+  present = (queued >= PACER_AUDIO_LOW_FRAMES);
+  if (!present) {
+    statDroppedFrames++;
+  }
+  while (queued > PACER_AUDIO_TARGET_FRAMES) {
+    // Sleep for roughly as long as the excess takes to play.
+    std::chrono::duration<double> excess(
+      (queued - PACER_AUDIO_TARGET_FRAMES) / SAMPLE_RATE);
+    std::this_thread::sleep_for(excess);
+    queued = audio->queued();
+  }
+  statFrames++;
+  // If we switch back to the host clock, start from here.
+  lastSpeedIndex = -1;
+  if (reportStats && (statFrames >= PACER_REPORT_FRAMES)) {
+    printStats();
+  }
+}
+
+bool FramePacer::shouldPresent() {
+  return present;
+}
+
+void FramePacer::setFrameskip(int n) {
+  frameskip = n;
+  skipped = 0;
+}
+
+int FramePacer::parseFrameskip(const char *s) {
+  if (!strcmp(s, "auto")) {
+    return PACER_FRAMESKIP_AUTO;
+  }
+  char *end;
+  long n = strtol(s, &end, 10);
+  if ((end == s) || *end || (n < 0)) {
+    return -2;
+  }
+  return n;
+}
+
+void FramePacer::setSync(pacer_sync s) {
+  syncMode = s;
+}
+
+pacer_sync FramePacer::getSync() {
+  return (pacer_sync) syncMode.load();
+}
+
+void FramePacer::toggleSync() {
+  setSync((getSync() == PACE_VIDEO) ? PACE_AUDIO : PACE_VIDEO);
+}
+
+void FramePacer::printStats() {
+  clock::time_point now = clock::now();
+  double seconds = std::chrono::duration<double>(now - statStart).count();
+  if (statFrames && (seconds > 0)) {
+    if (lastSpeedIndex < 0) {
+      fprintf(stderr,
+              "pacer: %.2f fps (audio sync), %ld frames dropped\n",
+              statFrames / seconds, statDroppedFrames);
+    } else {
+      fprintf(stderr,
+              "pacer: %.2f fps (target %.2f), "
+              "jitter mean %.0fus max %.0fus, %ld resyncs, "
+              "%ld skipped\n",
+              statFrames / seconds,
+              PACER_SPEEDS[lastSpeedIndex] * CPU_CYCLES_PER_SECOND
+              / CPU_CYCLES_PER_FRAME,
+              statLatenessSumUs / statFrames, statLatenessMaxUs,
+              statLateFrames, statSkippedFrames);
+    }
+    if (audio) {
+      fprintf(stderr,
+              "pacer: audio queue %zu frames, "
+              "%llu frames underrun, %llu overrun so far\n",
+              audio->queued(), (unsigned long long) audio->underruns(),
+              (unsigned long long) audio->overruns());
+    }
+  }
+  statFrames = 0;
+  statLateFrames = 0;
+  statDroppedFrames = 0;
+  statSkippedFrames = 0;
+  statLatenessSumUs = 0;
+  statLatenessMaxUs = 0;
+  statStart = now;
+}
+
+void FramePacer::setSpeed(int index) {
+  if ((index < 0) || (index >= N_PACER_SPEEDS)) {
+    return;
+  }
+  speedIndex = index;
+}
+
+int FramePacer::getSpeed() {
+  return speedIndex;
+}
+
+void FramePacer::faster() {
+  int index = speedIndex;
+  if (index < PACER_UNCAPPED) {
+    setSpeed(index + 1);
+  }
+}
+
+void FramePacer::slower() {
+  int index = speedIndex;
+  if (index == PACER_UNCAPPED) {
+    setSpeed(turboReturnSpeed);
+  } else if (index > 0) {
+    setSpeed(index - 1);
+  }
+}
+
+void FramePacer::toggleTurbo() {
+  int index = speedIndex;
+  if (index == PACER_UNCAPPED) {
+    setSpeed(turboReturnSpeed);
+  } else {
+    turboReturnSpeed = index;
+    setSpeed(PACER_UNCAPPED);
+  }
+}
+
+int FramePacer::parseSpeed(const char *s) {
+  if (!strcmp(s, "uncapped")) {
+    return PACER_UNCAPPED;
+  }
+  char *end;
+  double multiplier = strtod(s, &end);
+  if ((end == s) || *end) {
+    return -1;
+  }
+  for (int i = 0; i < N_PACER_SPEEDS; i++) {
+    if (PACER_SPEEDS[i] == multiplier) {
+      return i;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,132 @@
+#ifndef FRAMEPACER_H
+
+#define FRAMEPACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Paces emulation to the real refresh rate, CPU_CYCLES_PER_SECOND /
+// CPU_CYCLES_PER_FRAME (about 59.73 Hz, not the 60 Hz that vsync
+// would give us), times a speed multiplier.
+
+// Speed multipliers selectable at runtime. 0 means uncapped.
+const float PACER_SPEEDS[] = {0.25, 0.5, 1.0, 2.0, 4.0, 8.0, 0.0};
+const int N_PACER_SPEEDS = sizeof(PACER_SPEEDS) / sizeof(PACER_SPEEDS[0]);
+const int PACER_NORMAL_SPEED = 2;
+const int PACER_UNCAPPED = N_PACER_SPEEDS - 1;
+
+// Sleeping is only accurate to a millisecond or so, so sleep until
+// this long before the deadline and spin the rest of the way.
+const std::chrono::microseconds PACER_SPIN_MARGIN(1500);
+
+// If we fall further behind than this (a debugger session, a slow
+// swap), give up on catching up and start pacing from now.
+const int PACER_MAX_FRAMES_BEHIND = 4;
+
+// Above normal speed, don't present frames more often than this.
+const std::chrono::microseconds PACER_PRESENT_INTERVAL(16000);
+
+// Frameskip: render one frame, then skip this many. Skipped frames
+// still run in full (LY, STAT and interrupts are exactly as usual);
+// the PPU just doesn't draw them. PACER_FRAMESKIP_AUTO skips only
+// when pacing falls behind, and never more than PACER_MAX_FRAMESKIP
+// frames in a row.
+const int PACER_FRAMESKIP_AUTO = -1;
+const int PACER_MAX_FRAMESKIP = 4;
+
+// How often to print stats, when asked to.
+const int PACER_REPORT_FRAMES = 600;
+
+// What decides when a frame is due: the host clock (PACE_VIDEO,
+// named for what it replaces: vsync), or how full the audio output
+// queue is (PACE_AUDIO). The audio device's clock is the one the
+// listener actually hears, so syncing to it can't drift, whatever
+// the display's refresh rate.
+enum pacer_sync {
+  PACE_VIDEO,
+  PACE_AUDIO
+};
+
+// In audio sync, keep about this many frames queued (in samples; the
+// output callback asks for FRAMES_PER_BUFFER at a time). Below the
+// low-water mark we're falling behind, so stop presenting video until
+// we catch up.
+const size_t PACER_AUDIO_TARGET_FRAMES = 2048;
+const size_t PACER_AUDIO_LOW_FRAMES = 768;
+
+class Audio;
+
+class FramePacer {
+public:
+  FramePacer();
+
+  // Call at the end of every emulated frame. Blocks until the frame
+  // is due at the current speed.
+  void frame();
+
+  // Speeds are indices into PACER_SPEEDS. These are safe to call from
+  // any thread.
+  void setSpeed(int index);
+  int getSpeed();
+  void faster();
+  void slower();
+  // Flip between uncapped and whatever we were running at before.
+  void toggleTurbo();
+
+  // Audio sync only applies at normal speed; at any other speed we
+  // fall back to the host clock.
+  void setSync(pacer_sync);
+  pacer_sync getSync();
+  void toggleSync();
+  Audio *audio;
+
+  // Whether the current frame will be shown, so whether it's worth
+  // rendering at all. Decided at the end of the frame before, and
+  // false when audio sync is behind, when running fast enough that
+  // the display couldn't keep up anyway, or when frameskip says so.
+  bool shouldPresent();
+
+  // 0 (the default) renders every frame. See PACER_FRAMESKIP_AUTO.
+  void setFrameskip(int n);
+  // Parse a frameskip count or "auto". Returns -2 if it's neither.
+  static int parseFrameskip(const char *);
+
+  // Parse a multiplier like "0.25", "2" or "uncapped". Returns -1 if
+  // it isn't one of PACER_SPEEDS.
+  static int parseSpeed(const char *);
+
+  bool reportStats;
+  void printStats();
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  std::atomic<int> speedIndex;
+  std::atomic<int> syncMode;
+  bool present;
+  // Returns whether we're behind.
+  bool pace();
+  void waitForAudio();
+
+  int frameskip;
+  int skipped; // in a row, up to now
+
+  int turboReturnSpeed;
+  int lastSpeedIndex;
+
+  clock::time_point deadline;
+  clock::time_point lastPresent;
+  clock::duration framePeriod(int index);
+
+  // stats since the last report
+  long statFrames;
+  long statLateFrames;
+  long statDroppedFrames;
+  long statSkippedFrames;
+  double statLatenessSumUs;
+  double statLatenessMaxUs;
+  clock::time_point statStart;
+};
+
+#endif // #ifndef FRAMEPACER_H
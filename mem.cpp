@@ -207,19 +207,19 @@ uint8_t gb_ptr::read() {
       switch (addr) {
         // misc
       case REG_JOYPAD:
-        return cpu.screen->getKeys(cpu.joypad_mask);
+        return cpu.video->getKeys(cpu.joypad_mask);
         // Pressed buttons are 0, unpressed are 1. For now, don't
         // claim to be pressing all buttons at all times.
         return 0x3f;
       case REG_SERIAL_DATA:
-        break;
+        return cpu.serial_data;
       case REG_SERIAL_CONTROL:
-        break;
+        // unused bits read as 1
+        return cpu.serial_control | 0x7e;
       case REG_DIVIDER:
-        return cpu.fine_divider >> 8;
-        break;
+        return cpu.divider() >> 8;
       case REG_TIMER_COUNT:
-        return cpu.timer_count;
+        return cpu.read_timer_count();
       case REG_TIMER_MOD:
         return cpu.timer_mod;
       case REG_TIMER_CONTROL:
@@ -274,14 +274,13 @@ uint8_t gb_ptr::read() {
       case REG_LCD_CONTROL:
         return cpu.lcd_control;
       case REG_LCD_STATUS:
-        // TODO compute status
-        return cpu.lcd_status;
+        return cpu.read_lcd_status();
       case REG_SCROLL_Y:
         return cpu.scroll_y;
       case REG_SCROLL_X:
         return cpu.scroll_x;
       case REG_LCD_Y:
-        return cpu.lcd_y;
+        return cpu.read_lcd_y();
       case REG_LCD_Y_COMPARE:
         return cpu.lcd_y_compare;
       case REG_DMA: // write-only
@@ -304,6 +303,10 @@ uint8_t gb_ptr::read() {
     // 0xfe00
     if ((OAM_BASE <= addr) &&
         (addr < OAM_BASE + OAM_SIZE)) {
+      if (cpu.dma_active) {
+        // OAM is on the DMA unit's bus until the transfer finishes
+        return 0xff;
+      }
       return cpu.oam[addr - OAM_BASE];
     }
 
@@ -349,7 +352,12 @@ void gb_ptr::write(uint8_t to_write) {
     // 0x8000
     if ((VRAM_BASE <= addr) &&
         (addr < VRAM_BASE + VRAM_SIZE)) {
-      cpu.vram[addr - VRAM_BASE] = to_write;
+      // Rewriting the same value happens a lot (bulk copies,
+      // clears), and the PPU only needs to hear about changes.
+      if (cpu.vram[addr - VRAM_BASE] != to_write) {
+        cpu.vram[addr - VRAM_BASE] = to_write;
+        cpu.ppu->vramWritten(addr - VRAM_BASE);
+      }
       return;
     }
 
@@ -387,6 +395,13 @@ void gb_ptr::write(uint8_t to_write) {
       return;
     }
 
+    // Sound registers and wave RAM: bring the output up to date
+    // before the sound changes.
+    if ((REG_SOUND_1_0 <= addr) &&
+        (addr < WAVE_RAM_BASE + WAVE_RAM_SIZE)) {
+      cpu.audio->catchUp(cpu.cycles);
+    }
+
     // 0xff30
     if ((WAVE_RAM_BASE <= addr) &&
         (addr < WAVE_RAM_BASE + WAVE_RAM_SIZE)) {
@@ -406,22 +421,24 @@ void gb_ptr::write(uint8_t to_write) {
           printf("%c", to_write);
           fflush(stdout);
         }
-        // TODO
+        cpu.serial_data = to_write;
         return;
       case REG_SERIAL_CONTROL:
-        // TODO
+        cpu.serial_control = to_write & (SERIAL_CONTROL_START |
+                                         SERIAL_CONTROL_INTERNAL_CLOCK);
+        cpu.start_serial();
         return;
       case REG_DIVIDER:
-        cpu.fine_divider = 0; // ignore given value
+        cpu.reset_divider(); // ignore given value
         return;
       case REG_TIMER_COUNT:
-        cpu.timer_count = to_write;
+        cpu.write_timer_count(to_write);
         return;
       case REG_TIMER_MOD:
         cpu.timer_mod = to_write;
         return;
       case REG_TIMER_CONTROL:
-        cpu.timer_control = to_write;
+        cpu.write_timer_control(to_write);
         return;
       case REG_INTERRUPT:
         // COMPAT Are these masks correct? Unclear.
@@ -515,25 +532,32 @@ void gb_ptr::write(uint8_t to_write) {
       // Video registers
       // COMPAT Are any of these masked?
       case REG_LCD_CONTROL:
+      {
+        bool was_on = !!(cpu.lcd_control & 0x80);
         cpu.lcd_control = to_write;
+        cpu.ppu->registerWritten(addr, to_write);
         if (!(cpu.lcd_control & 0x80)) {
           cpu.reset_lcd();
+        } else if (!was_on) {
+          cpu.start_lcd();
         }
         return;
+      }
       case REG_LCD_STATUS:
-        // TODO update interrupts
-        cpu.lcd_status = to_write;
+        cpu.write_lcd_status(to_write);
         return;
       case REG_SCROLL_Y:
         cpu.scroll_y = to_write;
+        cpu.ppu->registerWritten(addr, to_write);
         return;
       case REG_SCROLL_X:
         cpu.scroll_x = to_write;
+        cpu.ppu->registerWritten(addr, to_write);
         return;
       case REG_LCD_Y: // read-only
         return;
       case REG_LCD_Y_COMPARE:
-        cpu.lcd_y_compare = to_write;
+        cpu.write_lcd_y_compare(to_write);
         return;
       case REG_DMA:
       {
@@ -545,7 +569,9 @@ void gb_ptr::write(uint8_t to_write) {
         // official programming manual seems to say it's actually
         // 160*4=640 cpu clock cycles.)
 
-        // COMPAT: this transfer should happen over time
+        // COMPAT: this transfer should happen over time. For now we
+        // copy everything up front and only lock OAM until
+        // EVENT_DMA fires.
 
         // COMPAT: during the transfer, all memory except high RAM
         // should be unavailable
@@ -555,25 +581,36 @@ void gb_ptr::write(uint8_t to_write) {
 
         uint16_t dma_addr = to_write * 0x100;
         for (unsigned int i = 0; i < OAM_SIZE; i++) {
-          cpu.oam[i] = gb_mem_ptr(cpu, dma_addr+i).read();
+          uint8_t byte = gb_mem_ptr(cpu, dma_addr+i).read();
+          // Most games DMA the same sprites in every frame.
+          if (cpu.oam[i] != byte) {
+            cpu.oam[i] = byte;
+            cpu.ppu->oamWritten(i);
+          }
         }
+        cpu.start_dma();
 
         return;
       }
       case REG_BG_PALETTE:
         cpu.bg_palette = to_write;
+        cpu.ppu->registerWritten(addr, to_write);
         return;
       case REG_OBJ_PALETTE_0:
         cpu.obj_palette_0 = to_write;
+        cpu.ppu->registerWritten(addr, to_write);
         return;
       case REG_OBJ_PALETTE_1:
         cpu.obj_palette_1 = to_write;
+        cpu.ppu->registerWritten(addr, to_write);
         return;
       case REG_WINDOW_Y:
         cpu.window_y = to_write;
+        cpu.ppu->registerWritten(addr, to_write);
         return;
       case REG_WINDOW_X:
         cpu.window_x = to_write;
+        cpu.ppu->registerWritten(addr, to_write);
         return;
       default:
         break;
@@ -583,7 +620,10 @@ void gb_ptr::write(uint8_t to_write) {
     // 0xfe00
     if ((OAM_BASE <= addr) &&
         (addr < OAM_BASE + OAM_SIZE)) {
-      cpu.oam[addr - OAM_BASE] = to_write;
+      if (cpu.oam[addr - OAM_BASE] != to_write) {
+        cpu.oam[addr - OAM_BASE] = to_write;
+        cpu.ppu->oamWritten(addr - OAM_BASE);
+      }
       return;
     }
 
@@ -0,0 +1,160 @@
+// Microbenchmark for the pixel kernels and upscalers: checks every
+// version against the scalar one, then times each on a frame's worth
+// of work.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "pixelkernels.hpp"
+#include "upscale.hpp"
+
+const int BENCH_ROWS = 384 * 8; // all of tile data
+const int BENCH_LINE = 160;
+const int BENCH_LINES = 144;
+const int BENCH_ITERATIONS = 2000;
+const int BENCH_UPSCALE_ITERATIONS = 500;
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double usSince(bench_clock::time_point start) {
+  return std::chrono::duration<double, std::micro>(
+    bench_clock::now() - start).count();
+}
+
+// One frame at a time, through each filter. The input is mostly flat
+// areas with some edges, like a real screen, so the Scale2x family's
+// branches go both ways.
+static int benchUpscalers() {
+  std::vector<uint8_t> frame(BENCH_LINE * BENCH_LINES);
+  for (size_t i = 0; i < frame.size(); i++) {
+    frame[i] = ((i / 7) ^ (i / BENCH_LINE / 5)) & 3;
+    if (!(rand() % 8)) {
+      frame[i] = rand() & 3;
+    }
+  }
+  const int factors[3] = {2, 3, 4};
+
+  std::vector<upscale_kernels> all = available_upscale_kernels();
+  const upscale_kernels &scalar = all[0];
+  const size_t maxOut = frame.size() * 16;
+  std::vector<uint8_t> expected(maxOut), out(maxOut);
+  int failed = 0;
+  for (size_t k = 0; k < all.size(); k++) {
+    const upscale_kernels &kernels = all[k];
+    bool ok = 1;
+    for (int f = 0; f < 3; f++) {
+      size_t n = frame.size() * factors[f] * factors[f];
+      scalar.nearest(frame.data(), BENCH_LINE, BENCH_LINES, factors[f],
+                     expected.data());
+      kernels.nearest(frame.data(), BENCH_LINE, BENCH_LINES, factors[f],
+                      out.data());
+      ok = ok && !memcmp(out.data(), expected.data(), n);
+    }
+    scalar.scale2x(frame.data(), BENCH_LINE, BENCH_LINES, expected.data());
+    kernels.scale2x(frame.data(), BENCH_LINE, BENCH_LINES, out.data());
+    ok = ok && !memcmp(out.data(), expected.data(), frame.size() * 4);
+    scalar.scale3x(frame.data(), BENCH_LINE, BENCH_LINES, expected.data());
+    kernels.scale3x(frame.data(), BENCH_LINE, BENCH_LINES, out.data());
+    ok = ok && !memcmp(out.data(), expected.data(), frame.size() * 9);
+    if (!ok) {
+      printf("%s: upscaled results differ from scalar\n", kernels.name);
+      failed = 1;
+      continue;
+    }
+
+    double nearestUs[3];
+    for (int f = 0; f < 3; f++) {
+      bench_clock::time_point start = bench_clock::now();
+      for (int i = 0; i < BENCH_UPSCALE_ITERATIONS; i++) {
+        kernels.nearest(frame.data(), BENCH_LINE, BENCH_LINES, factors[f],
+                        out.data());
+      }
+      nearestUs[f] = usSince(start) / BENCH_UPSCALE_ITERATIONS;
+    }
+    bench_clock::time_point start = bench_clock::now();
+    for (int i = 0; i < BENCH_UPSCALE_ITERATIONS; i++) {
+      kernels.scale2x(frame.data(), BENCH_LINE, BENCH_LINES, out.data());
+    }
+    double scale2xUs = usSince(start) / BENCH_UPSCALE_ITERATIONS;
+    start = bench_clock::now();
+    for (int i = 0; i < BENCH_UPSCALE_ITERATIONS; i++) {
+      kernels.scale3x(frame.data(), BENCH_LINE, BENCH_LINES, out.data());
+    }
+    double scale3xUs = usSince(start) / BENCH_UPSCALE_ITERATIONS;
+
+    printf("%-8s nearest 2x/3x/4x: %7.2f/%7.2f/%7.2fus   "
+           "scale2x (epx): %7.2fus   scale3x: %7.2fus\n",
+           kernels.name, nearestUs[0], nearestUs[1], nearestUs[2],
+           scale2xUs, scale3xUs);
+  }
+  printf("using %s\n", best_upscale_kernels().name);
+  return failed;
+}
+
+int main(int argc, char **argv) {
+  std::vector<uint8_t> planes(BENCH_ROWS * 2);
+  std::vector<uint8_t> colors(BENCH_LINE * BENCH_LINES);
+  for (size_t i = 0; i < planes.size(); i++) {
+    planes[i] = rand();
+  }
+  for (size_t i = 0; i < colors.size(); i++) {
+    colors[i] = rand() & 3;
+  }
+  const uint8_t palette = 0xe4;
+
+  std::vector<pixel_kernels> all = available_pixel_kernels();
+  const pixel_kernels &scalar = all[0];
+  std::vector<uint8_t> expected(BENCH_ROWS * 8);
+  std::vector<uint8_t> expectedFlipped(BENCH_ROWS * 8);
+  std::vector<uint8_t> expectedShades(colors.size());
+  scalar.decode_2bpp(planes.data(), BENCH_ROWS, expected.data(), 0);
+  scalar.decode_2bpp(planes.data(), BENCH_ROWS, expectedFlipped.data(), 1);
+  scalar.map_palette(colors.data(), colors.size(), palette,
+                     expectedShades.data());
+
+  std::vector<uint8_t> out(BENCH_ROWS * 8);
+  std::vector<uint8_t> shades(colors.size());
+  int failed = 0;
+  for (size_t k = 0; k < all.size(); k++) {
+    const pixel_kernels &kernels = all[k];
+
+    // odd sizes too, to exercise the tail handling
+    kernels.decode_2bpp(planes.data(), BENCH_ROWS - 3, out.data(), 0);
+    bool ok = !memcmp(out.data(), expected.data(), (BENCH_ROWS - 3) * 8);
+    kernels.decode_2bpp(planes.data(), BENCH_ROWS, out.data(), 1);
+    ok = ok && !memcmp(out.data(), expectedFlipped.data(), out.size());
+    kernels.map_palette(colors.data(), colors.size() - 5, palette,
+                        shades.data());
+    ok = ok && !memcmp(shades.data(), expectedShades.data(),
+                       colors.size() - 5);
+    if (!ok) {
+      printf("%s: results differ from scalar\n", kernels.name);
+      failed = 1;
+      continue;
+    }
+
+    bench_clock::time_point start = bench_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+      kernels.decode_2bpp(planes.data(), BENCH_ROWS, out.data(), i & 1);
+    }
+    double decodeUs = usSince(start) / BENCH_ITERATIONS;
+
+    start = bench_clock::now();
+    for (int i = 0; i < BENCH_ITERATIONS; i++) {
+      for (int line = 0; line < BENCH_LINES; line++) {
+        kernels.map_palette(colors.data() + line * BENCH_LINE, BENCH_LINE,
+                            palette + i, shades.data() + line * BENCH_LINE);
+      }
+    }
+    double mapUs = usSince(start) / BENCH_ITERATIONS;
+
+    printf("%-8s decode %d tile rows: %8.2fus   "
+           "palette map %d lines: %8.2fus\n",
+           kernels.name, BENCH_ROWS, decodeUs, BENCH_LINES, mapUs);
+  }
+  printf("using %s\n", best_pixel_kernels().name);
+  return failed | benchUpscalers();
+}
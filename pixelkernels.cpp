@@ -0,0 +1,201 @@
+#include "pixelkernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+static void decode_2bpp_scalar(const uint8_t *planes, int rows,
+                               uint8_t *out, bool flip) {
+  for (int r = 0; r < rows; r++) {
+    uint8_t low = planes[r*2];
+    uint8_t high = planes[r*2 + 1];
+    for (int x = 0; x < 8; x++) {
+      int bit = flip ? x : 7 - x;
+      out[r*8 + x] = ((low >> bit) & 1) | (((high >> bit) & 1) << 1);
+    }
+  }
+}
+
+static void map_palette_scalar(const uint8_t *colors, int n,
+                               uint8_t palette, uint8_t *out) {
+  const uint8_t shades[4] = {
+    (uint8_t) (palette & 3), (uint8_t) ((palette >> 2) & 3),
+    (uint8_t) ((palette >> 4) & 3), (uint8_t) ((palette >> 6) & 3)
+  };
+  for (int i = 0; i < n; i++) {
+    out[i] = shades[colors[i] & 3];
+  }
+}
+
+#ifdef PIXEL_KERNELS_X86
+
+// Bit masks for pixels 0-7 of a row, leftmost pixel in the high bit.
+static const uint8_t PIXEL_BITS[16] = {
+  0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+  0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+};
+static const uint8_t PIXEL_BITS_FLIPPED[16] = {
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80
+};
+
+// SSE2 decodes 8 rows at a time: split out the two bitplanes, spread
+// each byte across the 8 pixels of its row, and test one bit per
+// pixel.
+__attribute__((target("sse2")))
+static void decode_2bpp_sse2(const uint8_t *planes, int rows,
+                             uint8_t *out, bool flip) {
+  const __m128i bits = _mm_loadu_si128(
+    (const __m128i *) (flip ? PIXEL_BITS_FLIPPED : PIXEL_BITS));
+  const __m128i lowByte = _mm_set1_epi16(0x00ff);
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i two = _mm_set1_epi8(2);
+  int r = 0;
+  for (; r + 8 <= rows; r += 8) {
+    __m128i in = _mm_loadu_si128((const __m128i *) (planes + r*2));
+    // 8 low planes, 8 high planes
+    __m128i planes8 = _mm_packus_epi16(_mm_and_si128(in, lowByte),
+                                       _mm_srli_epi16(in, 8));
+    // each plane byte, repeated 8 times: lows in lo[], highs in hi[]
+    __m128i x2 = _mm_unpacklo_epi8(planes8, planes8);
+    __m128i x2h = _mm_unpackhi_epi8(planes8, planes8);
+    __m128i x4[4] = {
+      _mm_unpacklo_epi16(x2, x2), _mm_unpackhi_epi16(x2, x2),
+      _mm_unpacklo_epi16(x2h, x2h), _mm_unpackhi_epi16(x2h, x2h)
+    };
+    for (int i = 0; i < 2; i++) {
+      for (int half = 0; half < 2; half++) {
+        __m128i lo = half
+          ? _mm_unpackhi_epi32(x4[i], x4[i])
+          : _mm_unpacklo_epi32(x4[i], x4[i]);
+        __m128i hi = half
+          ? _mm_unpackhi_epi32(x4[i+2], x4[i+2])
+          : _mm_unpacklo_epi32(x4[i+2], x4[i+2]);
+        __m128i loSet = _mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits);
+        __m128i hiSet = _mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits);
+        __m128i pixels = _mm_or_si128(_mm_and_si128(loSet, one),
+                                      _mm_and_si128(hiSet, two));
+        _mm_storeu_si128((__m128i *) (out + (r + i*4 + half*2) * 8), pixels);
+      }
+    }
+  }
+  decode_2bpp_scalar(planes + r*2, rows - r, out + r*8, flip);
+}
+
+// SSE2 has no byte shuffle, so look the palette up by comparing
+// against each of the four colors.
+__attribute__((target("sse2")))
+static void map_palette_sse2(const uint8_t *colors, int n,
+                             uint8_t palette, uint8_t *out) {
+  __m128i shade[4];
+  __m128i color[4];
+  for (int c = 0; c < 4; c++) {
+    shade[c] = _mm_set1_epi8((palette >> (c*2)) & 3);
+    color[c] = _mm_set1_epi8(c);
+  }
+  int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i in = _mm_loadu_si128((const __m128i *) (colors + i));
+    __m128i result = _mm_setzero_si128();
+    for (int c = 0; c < 4; c++) {
+      result = _mm_or_si128(result,
+                            _mm_and_si128(_mm_cmpeq_epi8(in, color[c]),
+                                          shade[c]));
+    }
+    _mm_storeu_si128((__m128i *) (out + i), result);
+  }
+  map_palette_scalar(colors + i, n - i, palette, out + i);
+}
+
+// AVX2 decodes 16 rows at a time. Each 128-bit lane is a copy of the
+// SSE2 version, working on 8 rows.
+__attribute__((target("avx2")))
+static void decode_2bpp_avx2(const uint8_t *planes, int rows,
+                             uint8_t *out, bool flip) {
+  const __m256i bits = _mm256_broadcastsi128_si256(_mm_loadu_si128(
+    (const __m128i *) (flip ? PIXEL_BITS_FLIPPED : PIXEL_BITS)));
+  const __m256i lowByte = _mm256_set1_epi16(0x00ff);
+  const __m256i one = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi8(2);
+  int r = 0;
+  for (; r + 16 <= rows; r += 16) {
+    __m256i in = _mm256_loadu_si256((const __m256i *) (planes + r*2));
+    __m256i planes8 = _mm256_packus_epi16(_mm256_and_si256(in, lowByte),
+                                          _mm256_srli_epi16(in, 8));
+    __m256i x2 = _mm256_unpacklo_epi8(planes8, planes8);
+    __m256i x2h = _mm256_unpackhi_epi8(planes8, planes8);
+    __m256i x4[4] = {
+      _mm256_unpacklo_epi16(x2, x2), _mm256_unpackhi_epi16(x2, x2),
+      _mm256_unpacklo_epi16(x2h, x2h), _mm256_unpackhi_epi16(x2h, x2h)
+    };
+    for (int i = 0; i < 2; i++) {
+      for (int half = 0; half < 2; half++) {
+        __m256i lo = half
+          ? _mm256_unpackhi_epi32(x4[i], x4[i])
+          : _mm256_unpacklo_epi32(x4[i], x4[i]);
+        __m256i hi = half
+          ? _mm256_unpackhi_epi32(x4[i+2], x4[i+2])
+          : _mm256_unpacklo_epi32(x4[i+2], x4[i+2]);
+        __m256i loSet = _mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits);
+        __m256i hiSet = _mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits);
+        __m256i pixels = _mm256_or_si256(_mm256_and_si256(loSet, one),
+                                         _mm256_and_si256(hiSet, two));
+        // low lane is rows r.., high lane rows r+8..
+        int row = r + i*4 + half*2;
+        _mm_storeu_si128((__m128i *) (out + row * 8),
+                         _mm256_castsi256_si128(pixels));
+        _mm_storeu_si128((__m128i *) (out + (row + 8) * 8),
+                         _mm256_extracti128_si256(pixels, 1));
+      }
+    }
+  }
+  // The rest is done with legacy SSE code; switching to that with the
+  // upper halves dirty is very slow on some CPUs.
+  _mm256_zeroupper();
+  decode_2bpp_sse2(planes + r*2, rows - r, out + r*8, flip);
+}
+
+// With a byte shuffle, the palette is a 4-entry lookup table.
+__attribute__((target("avx2")))
+static void map_palette_avx2(const uint8_t *colors, int n,
+                             uint8_t palette, uint8_t *out) {
+  uint32_t entries = ((palette & 3) |
+                      (((palette >> 2) & 3) << 8) |
+                      (((palette >> 4) & 3) << 16) |
+                      (((palette >> 6) & 3) << 24));
+  const __m256i table = _mm256_broadcastsi128_si256(
+    _mm_cvtsi32_si128(entries));
+  const __m256i mask = _mm256_set1_epi8(3);
+  int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i in = _mm256_loadu_si256((const __m256i *) (colors + i));
+    _mm256_storeu_si256((__m256i *) (out + i),
+                        _mm256_shuffle_epi8(table,
+                                            _mm256_and_si256(in, mask)));
+  }
+  _mm256_zeroupper();
+  map_palette_sse2(colors + i, n - i, palette, out + i);
+}
+
+#endif // #ifdef PIXEL_KERNELS_X86
+
+std::vector<pixel_kernels> available_pixel_kernels() {
+  std::vector<pixel_kernels> out;
+  out.push_back({"scalar", decode_2bpp_scalar, map_palette_scalar});
+#ifdef PIXEL_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    out.push_back({"sse2", decode_2bpp_sse2, map_palette_sse2});
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    out.push_back({"avx2", decode_2bpp_avx2, map_palette_avx2});
+  }
+#endif
+  return out;
+}
+
+const pixel_kernels &best_pixel_kernels() {
+  static const pixel_kernels best = available_pixel_kernels().back();
+  return best;
+}
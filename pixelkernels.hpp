@@ -0,0 +1,35 @@
+#ifndef PIXELKERNELS_H
+
+#define PIXELKERNELS_H
+
+#include <cstdint>
+#include <vector>
+
+// The renderer's inner loops, with SIMD versions where the CPU has
+// them. Which version to use is decided once at runtime, so one build
+// runs everywhere.
+
+// Turn rows of 2bpp tile data (a low bitplane byte then a high
+// bitplane byte per row, as in VRAM) into 8 color indices (0-3) per
+// row. With flip set, each row comes out mirrored, for sprites.
+typedef void (*decode_2bpp_fn)(const uint8_t *planes, int rows,
+                               uint8_t *out, bool flip);
+
+// Map n color indices through a palette register (BGP, OBP0 or
+// OBP1), giving the 2-bit shade each one is displayed as.
+typedef void (*map_palette_fn)(const uint8_t *colors, int n,
+                               uint8_t palette, uint8_t *out);
+
+struct pixel_kernels {
+  const char *name;
+  decode_2bpp_fn decode_2bpp;
+  map_palette_fn map_palette;
+};
+
+// Every version this build and this CPU support, scalar first.
+std::vector<pixel_kernels> available_pixel_kernels();
+
+// The best of those. Chosen the first time it's called.
+const pixel_kernels &best_pixel_kernels();
+
+#endif // #ifndef PIXELKERNELS_H
@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <cstring>
+
+#include "ppu.hpp"
+#include "capture.hpp"
+#include "cpu.hpp"
+#include "framehash.hpp"
+#include "mem.hpp"
+
+PPU::PPU(CPU *cpu)
+  : frameChanged(1), frameHash(0), frameCount(0),
+    cpu(cpu), kernels(&best_pixel_kernels()),
+    vram(cpu->vram), oam(cpu->oam),
+    useWorker(0), workerRunning(0),
+    windowLine(0), memoryVersion(1), linesChanged(0), unpublished(0),
+    hashing(0), hashLog(NULL)
+{
+  memset(framebuffer, 0, sizeof(framebuffer));
+  memset(&regs, 0, sizeof(regs));
+  // version 0 never matches, so every line gets rendered once
+  memset(lineStates, 0, sizeof(lineStates));
+}
+
+PPU::~PPU() {
+  if (useWorker) {
+    workerRunning = 0;
+    worker.join();
+  }
+}
+
+void PPU::startWorker() {
+  if (useWorker) {
+    return;
+  }
+  // The worker starts from a copy of everything as it is now. The
+  // tile cache already matches VRAM.
+  workerVram.assign(cpu->vram, cpu->vram + VRAM_SIZE);
+  workerOam.assign(cpu->oam, cpu->oam + OAM_SIZE);
+  vram = workerVram.data();
+  oam = workerOam.data();
+  loadRegisters();
+
+  useWorker = 1;
+  workerRunning = 1;
+  worker = std::thread(&PPU::runWorker, this);
+}
+
+void PPU::sync() {
+  while (useWorker && !log.empty()) {
+    std::this_thread::yield();
+  }
+}
+
+void PPU::runWorker() {
+  int idle = 0;
+  while (workerRunning) {
+    const ppu_write *w = log.peek();
+    if (!w) {
+      if (idle < PPU_WORKER_SPINS) {
+        idle++;
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(PPU_WORKER_SLEEP);
+      }
+      continue;
+    }
+    idle = 0;
+    replay(*w);
+    log.pop();
+  }
+}
+
+void PPU::logWrite(uint16_t addr, uint8_t value) {
+  log.push({cpu->cycles, addr, value});
+}
+
+void PPU::replay(const ppu_write &w) {
+  if (w.addr == PPU_LOG_LINE) {
+    drawLine(w.value);
+  } else if (w.addr == PPU_LOG_FRAME) {
+    finishFrame(w.value);
+  } else if ((VRAM_BASE <= w.addr) && (w.addr < VRAM_BASE + VRAM_SIZE)) {
+    uint16_t offset = w.addr - VRAM_BASE;
+    workerVram[offset] = w.value;
+    memoryVersion++;
+    if (offset < TILE_DATA_SIZE) {
+      decodeTileRow(offset / 16, (offset % 16) / 2);
+    }
+  } else if ((OAM_BASE <= w.addr) && (w.addr < OAM_BASE + OAM_SIZE)) {
+    workerOam[w.addr - OAM_BASE] = w.value;
+    memoryVersion++;
+  } else {
+    switch (w.addr) {
+    case REG_LCD_CONTROL: regs.lcd_control = w.value; break;
+    case REG_SCROLL_Y: regs.scroll_y = w.value; break;
+    case REG_SCROLL_X: regs.scroll_x = w.value; break;
+    case REG_BG_PALETTE: regs.bg_palette = w.value; break;
+    case REG_OBJ_PALETTE_0: regs.obj_palette_0 = w.value; break;
+    case REG_OBJ_PALETTE_1: regs.obj_palette_1 = w.value; break;
+    case REG_WINDOW_Y: regs.window_y = w.value; break;
+    case REG_WINDOW_X: regs.window_x = w.value; break;
+    }
+  }
+}
+
+void PPU::loadRegisters() {
+  regs.lcd_control = cpu->lcd_control;
+  regs.scroll_y = cpu->scroll_y;
+  regs.scroll_x = cpu->scroll_x;
+  regs.bg_palette = cpu->bg_palette;
+  regs.obj_palette_0 = cpu->obj_palette_0;
+  regs.obj_palette_1 = cpu->obj_palette_1;
+  regs.window_y = cpu->window_y;
+  regs.window_x = cpu->window_x;
+}
+
+void PPU::decodeTileRow(int tile, int y) {
+  // The LCD sees VRAM directly, not through the bus.
+  const uint8_t *planes = vram + tile * 16 + y*2;
+  kernels->decode_2bpp(planes, 1, tileCache[0][tile][y], 0);
+  kernels->decode_2bpp(planes, 1, tileCache[1][tile][y], 1);
+}
+
+void PPU::vramWritten(uint16_t offset) {
+  if (useWorker) {
+    logWrite(VRAM_BASE + offset, cpu->vram[offset]);
+    return;
+  }
+  memoryVersion++;
+  if (offset < TILE_DATA_SIZE) {
+    decodeTileRow(offset / 16, (offset % 16) / 2);
+  }
+}
+
+void PPU::oamWritten(uint16_t offset) {
+  if (useWorker) {
+    logWrite(OAM_BASE + offset, cpu->oam[offset]);
+  } else {
+    memoryVersion++;
+  }
+}
+
+void PPU::registerWritten(uint16_t addr, uint8_t value) {
+  if (useWorker) {
+    logWrite(addr, value);
+  }
+}
+
+void PPU::decodeAllTiles() {
+  // Tile data and the cache are both laid out row after row, so this
+  // is one long run for the kernel.
+  kernels->decode_2bpp(vram, N_TILES * 8, tileCache[0][0][0], 0);
+  kernels->decode_2bpp(vram, N_TILES * 8, tileCache[1][0][0], 1);
+  memoryVersion++;
+}
+
+// Look up a tile number in a BG or window map, and turn it into a
+// tile cache index. With signed tile numbers, tile 0 is at 0x9000.
+int PPU::bgTile(uint16_t map_addr, bool tile_signed) {
+  uint8_t tile_code = vram[map_addr - VRAM_BASE];
+  return tile_signed ? 256 + (int8_t) tile_code : tile_code;
+}
+
+void PPU::renderLine(int line) {
+  if (useWorker) {
+    logWrite(PPU_LOG_LINE, line);
+    return;
+  }
+  loadRegisters();
+  drawLine(line);
+}
+
+void PPU::endFrame(bool present) {
+  if (useWorker) {
+    logWrite(PPU_LOG_FRAME, present);
+  } else {
+    finishFrame(present);
+  }
+}
+
+void PPU::hashFrames(FILE *log) {
+  hashing = 1;
+  hashLog = log;
+}
+
+void PPU::finishFrame(bool present) {
+  // Skipped frames (see FramePacer) render nothing, so they don't
+  // count as changed; the frame after them compares against the last
+  // one actually rendered.
+  frameChanged = linesChanged;
+  linesChanged = 0;
+  if (frameChanged) {
+    unpublished = 1;
+  }
+  if (hashing) {
+    // An unchanged frame has the same hash as last time.
+    if (frameChanged || !frameCount) {
+      frameHash = frame_hash(framebuffer, sizeof(framebuffer));
+    }
+    if (hashLog) {
+      fprintf(hashLog, "%llu %016llx\n", (unsigned long long) frameCount,
+              (unsigned long long) frameHash);
+    }
+    frameCount++;
+  }
+  // Capturing means no frame is skipped, so this sees every one and
+  // the capture's own interval picks which to keep.
+  if (cpu->capture) {
+    cpu->capture->frame(framebuffer);
+  }
+  // Otherwise what's on screen is already this.
+  if (present && unpublished) {
+    cpu->video->publishFrame(framebuffer);
+    unpublished = 0;
+  }
+}
+
+void PPU::drawLine(int line) {
+  if (line == 0) {
+    windowLine = 0;
+  }
+
+  line_state &last = lineStates[line];
+  if ((last.memoryVersion == memoryVersion) &&
+      (last.windowLine == windowLine) &&
+      !memcmp(&last.regs, &regs, sizeof(regs))) {
+    windowLine = last.windowLineAfter;
+    return;
+  }
+  last.memoryVersion = memoryVersion;
+  last.regs = regs;
+  last.windowLine = windowLine;
+  linesChanged = 1;
+
+  uint8_t colors[SCREEN_WIDTH];
+  uint8_t *shades = framebuffer + line * SCREEN_WIDTH;
+
+  // COMPAT: on the original gameboy, clearing the BG bit blanks the
+  // window too. (On the GBC it means something else entirely.)
+  if (regs.lcd_control & LCDC_BG_DISPLAY) {
+    drawBackgroundLine(line, colors);
+    if (regs.lcd_control & LCDC_WINDOW_DISPLAY) {
+      drawWindowLine(line, colors);
+    }
+    kernels->map_palette(colors, SCREEN_WIDTH, regs.bg_palette, shades);
+  } else {
+    // blank BG counts as color 0, so every sprite shows over it
+    memset(colors, 0, SCREEN_WIDTH);
+    memset(shades, 0, SCREEN_WIDTH);
+  }
+
+  if (regs.lcd_control & LCDC_SPRITE_DISPLAY) {
+    drawSpritesLine(line, colors, shades);
+  }
+  last.windowLineAfter = windowLine;
+}
+
+void PPU::drawBackgroundLine(int line, uint8_t *colors) {
+  const uint16_t bg_base = (regs.lcd_control & LCDC_BG_CODE)
+    ? 0x9c00 : 0x9800;
+  const bool tile_signed = !(regs.lcd_control & LCDC_BG_CHR);
+
+  int scrollspaceY = (line + regs.scroll_y) % 256;
+  int tileY = scrollspaceY / 8;
+  // A tile at a time; only the first and last are partial.
+  int screenX = 0;
+  while (screenX < SCREEN_WIDTH) {
+    int scrollspaceX = (screenX + regs.scroll_x) % 256;
+    int tileX = scrollspaceX / 8;
+    int block = tileY * 32 + tileX;
+
+    const uint8_t *pixels =
+      tileRow(bgTile(bg_base + block, tile_signed), scrollspaceY % 8, 0);
+    int x = scrollspaceX % 8;
+    int n = std::min(8 - x, SCREEN_WIDTH - screenX);
+    memcpy(colors + screenX, pixels + x, n);
+    screenX += n;
+  }
+}
+
+void PPU::drawWindowLine(int line, uint8_t *colors) {
+  const uint16_t bg_base = (regs.lcd_control & LCDC_WINDOW_CODE)
+    ? 0x9c00 : 0x9800;
+  const bool tile_signed = !(regs.lcd_control & LCDC_BG_CHR);
+
+  int screenLeft = regs.window_x - 7;
+  if ((line < regs.window_y) || (screenLeft >= SCREEN_WIDTH)) {
+    return;
+  }
+  // The window uses the bg palette, so it just overwrites bg colors.
+  int tileY = windowLine / 8;
+  int screenX = std::max(screenLeft, 0);
+  while (screenX < SCREEN_WIDTH) {
+    int windowX = screenX - screenLeft;
+    int block = tileY * 32 + windowX / 8;
+
+    const uint8_t *pixels =
+      tileRow(bgTile(bg_base + block, tile_signed), windowLine % 8, 0);
+    int x = windowX % 8;
+    int n = std::min(8 - x, SCREEN_WIDTH - screenX);
+    memcpy(colors + screenX, pixels + x, n);
+    screenX += n;
+  }
+  windowLine++;
+}
+
+// Find the sprites on this line, as the hardware's OAM scan does: in
+// OAM order, stopping at SPRITE_LIMIT. Sprites off the left or right
+// edge still count. Then sort them into priority order: on the DMG
+// the sprite further left wins, and OAM order breaks ties.
+int PPU::scanSprites(int line, int height, uint8_t *sprites) {
+  int n = 0;
+  for (int i = 0; (i < OAM_N_SPRITES) && (n < SPRITE_LIMIT); i++) {
+    // Read OAM directly: the bus version is locked during DMA, but
+    // the LCD always sees it.
+    int top = oam[i * SPRITE_SIZE] - SPRITE_Y_OFFSET;
+    if ((line >= top) && (line < top + height)) {
+      sprites[n++] = i;
+    }
+  }
+  std::stable_sort(sprites, sprites + n,
+                   [this](uint8_t a, uint8_t b) {
+                     return (oam[a * SPRITE_SIZE + 1] <
+                             oam[b * SPRITE_SIZE + 1]);
+                   });
+  return n;
+}
+
+void PPU::drawSpritesLine(int line, const uint8_t *bgColors,
+                          uint8_t *shades) {
+  const bool big_sprites = !!(regs.lcd_control & LCDC_SPRITE_SIZE);
+  const int height = big_sprites ? 16 : 8;
+
+  uint8_t sprites[SPRITE_LIMIT];
+  int n = scanSprites(line, height, sprites);
+  if (!n) {
+    return;
+  }
+
+  // Highest priority first. Once a sprite has an opaque pixel
+  // somewhere, no lower one can show there, even if that sprite is
+  // itself hidden behind the BG.
+  bool taken[SCREEN_WIDTH] = {0};
+  for (int s = 0; s < n; s++) {
+    const uint8_t *sprite = oam + sprites[s] * SPRITE_SIZE;
+    int top = sprite[0] - SPRITE_Y_OFFSET;
+    int left = sprite[1] - SPRITE_X_OFFSET;
+    uint8_t chr = sprite[2];
+    if (big_sprites) {
+      // clear least-significant bit
+      chr &= ~1;
+    }
+    uint8_t flags = sprite[3];
+
+    bool flipVert = !!(flags & SPRITE_FLIP_V);
+    bool flipHoriz = !!(flags & SPRITE_FLIP_H);
+    // With this set, the sprite only shows over BG color 0.
+    bool behindBg = !!(flags & SPRITE_PRIORITY);
+    uint8_t palette = (flags & SPRITE_PALETTE)
+      ? regs.obj_palette_1 : regs.obj_palette_0;
+
+    int dy = flipVert ? (height - 1) - (line - top) : line - top;
+    // Sprites always use unsigned tile numbers from 0x8000. 8x16
+    // sprites are two consecutive tiles.
+    const uint8_t *pixels = tileRow(chr + dy / 8, dy % 8, flipHoriz);
+    uint8_t spriteShades[8];
+    kernels->map_palette(pixels, 8, palette, spriteShades);
+    for (int screenX = std::max(left, 0);
+         screenX < std::min(left + 8, SCREEN_WIDTH);
+         screenX++) {
+      // color 0 is transparent
+      if (!pixels[screenX - left] || taken[screenX]) {
+        continue;
+      }
+      taken[screenX] = 1;
+      if (!behindBg || !bgColors[screenX]) {
+        shades[screenX] = spriteShades[screenX - left];
+      }
+    }
+  }
+}
@@ -0,0 +1,254 @@
+#ifndef PPU_H
+
+#define PPU_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "pixelkernels.hpp"
+#include "ppulog.hpp"
+
+// The picture processing unit: turns VRAM, OAM and the display
+// registers into pixels. It renders one line at a time, at the start
+// of that line's mode 3, using the registers as they are at that
+// point, so games that change them mid-frame (status bars, wavy
+// effects) come out right. Finished lines go into a framebuffer that
+// belongs to the emulator core; the video sink only gets copies.
+//
+// Optionally, the rendering itself happens on a worker thread. The
+// emulation thread then only logs what changed and when (see
+// ppulog.hpp), and the worker replays that against its own copy of
+// VRAM, OAM and the registers, a line at a time. Nothing the CPU can
+// read back depends on the worker: LY and STAT come from the cycle
+// count.
+
+const int SCREEN_WIDTH = 160;
+const int SCREEN_HEIGHT = 144;
+const int VBLANK_HEIGHT = 10;
+
+// There are 160 columns and 144 scanlines, as well as a 10-line
+// vblank period. Every line takes 108.7 microseconds. At a CPU
+// frequency of 4194304 Hz, that's about 456 clock cycles per
+// scanline. (455.92, probably caused by rounding error?) So that's
+// enough for... 2 cycles per column makes 320 total, with 136 left
+// over?
+
+// A random file on the internet ("GameBoy CPU Timing v0.01") confirms
+// 456 cycles per line and claims 70224 cycles per frame. I'll go with
+// that. Both numbers are doubled in the GBC's double-speed mode. The
+// super gameboy has slightly increased CPU speed and
+// correspondingly-increased sync speeds - presumably they're the same
+// number of cycles.
+
+// REG_LCD_CONTROL (LCDC) has 8 flags.
+// Bit 0: BG display (ignored in GBC)
+// Bit 1: Sprite display
+// Bit 2: Sprite size flag
+// Bit 3: BG code area selection flag
+//        0: 0x9800-0x9bff
+//        1: 0x9c00-0x0fff
+// Bit 4: BG character data selection flag
+//        0: 0x8800-0x97ff (signed indices)
+//        1: 0x8000-0x8fff (unsigned indices)
+// Bit 5: Windowing on/off
+// Bit 6: Window code area selection flag
+//        0: 0x9800-0x9bff
+//        1: 0x9c00-0x0fff
+// Bit 7: LCD on/off
+
+// code area selection must be analogous the the NES's nametables, and
+// character data selection to the pattern tables?
+
+// So the background tile map (must be the same as "code area"?) is 32
+// rows of 32 bytes each. Each byte is a tile number (signed or
+// unsigned index into the character data region).
+
+const int SPRITE_LIMIT = 10; // per line
+const int SPRITE_X_OFFSET = 8;
+const int SPRITE_Y_OFFSET = 16;
+
+const uint8_t LCDC_BG_DISPLAY = 1<<0;
+const uint8_t LCDC_SPRITE_DISPLAY = 1<<1;
+const uint8_t LCDC_SPRITE_SIZE = 1<<2;
+const uint8_t LCDC_BG_CODE = 1<<3;
+const uint8_t LCDC_BG_CHR = 1<<4;
+const uint8_t LCDC_WINDOW_DISPLAY = 1<<5;
+const uint8_t LCDC_WINDOW_CODE = 1<<6;
+const uint8_t LCDC_DISPLAY = 1<<7;
+
+// REG_LCD_STATUS (STAT): the low three bits are read-only status, the
+// next four choose which conditions raise INT_LCDC.
+const uint8_t STAT_MODE = 3;
+const uint8_t STAT_LYC_EQUAL = 1<<2;
+const uint8_t STAT_INT_HBLANK = 1<<3; // mode 0
+const uint8_t STAT_INT_VBLANK = 1<<4; // mode 1
+const uint8_t STAT_INT_OAM = 1<<5; // mode 2
+const uint8_t STAT_INT_LYC = 1<<6;
+const uint8_t STAT_INT_ALL = (STAT_INT_HBLANK |
+                              STAT_INT_VBLANK |
+                              STAT_INT_OAM |
+                              STAT_INT_LYC);
+
+const uint8_t LCD_MODE_HBLANK = 0;
+const uint8_t LCD_MODE_VBLANK = 1;
+const uint8_t LCD_MODE_OAM = 2;
+const uint8_t LCD_MODE_TRANSFER = 3;
+
+const uint8_t SPRITE_COLOR = 0xf; // color mode
+const uint8_t SPRITE_PALETTE = 1<<4; // non-color mode
+const uint8_t SPRITE_FLIP_H = 1<<5;
+const uint8_t SPRITE_FLIP_V = 1<<6;
+const uint8_t SPRITE_PRIORITY = 1<<7;
+
+// Tile data is 0x8000-0x97ff: 384 tiles of 8x8 pixels, 2 bits each,
+// stored as pairs of bitplanes.
+const int TILE_DATA_SIZE = 0x1800;
+const int N_TILES = TILE_DATA_SIZE / 16;
+
+// When the worker runs out of log, it spins this many times before
+// it starts sleeping between checks.
+const int PPU_WORKER_SPINS = 1000;
+const std::chrono::microseconds PPU_WORKER_SLEEP(50);
+
+// What rendering reads from the display registers.
+struct ppu_registers {
+  uint8_t lcd_control;
+  uint8_t scroll_y;
+  uint8_t scroll_x;
+  uint8_t bg_palette;
+  uint8_t obj_palette_0;
+  uint8_t obj_palette_1;
+  uint8_t window_y;
+  uint8_t window_x;
+};
+
+class CPU;
+
+class PPU {
+public:
+  PPU(CPU *cpu);
+  ~PPU();
+
+  // Render scanline `line` (0 to SCREEN_HEIGHT - 1) from the current
+  // register state.
+  void renderLine(int line);
+  // The frame is done (vblank has started). If `present` is set, hand
+  // it to the video sink.
+  void endFrame(bool present);
+
+  // Move rendering to a worker thread from here on. Call from the
+  // emulation thread, between instructions.
+  void startWorker();
+  // Wait until the worker has caught up with everything logged so
+  // far. After that, the framebuffer and tile cache are safe to read
+  // until the emulator runs again.
+  void sync();
+
+  // The current frame, row-major, one shade per pixel from 0
+  // (lightest) to 3 (darkest): what the palette registers map colors
+  // to. See DisplayPalette for turning these into real pixels. Lines
+  // are complete once renderLine returns; the whole frame is complete
+  // from vblank until line 0 is rendered again.
+  uint8_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];
+
+  // Tiles are kept decoded to one color (0-3) per byte, with a
+  // horizontally flipped copy for sprites, so rendering a line is
+  // mostly copying 8-pixel rows. Tile numbers here count from 0x8000,
+  // so they run from 0 to N_TILES - 1.
+  const uint8_t *tileRow(int tile, int y, bool flip) {
+    return tileCache[flip][tile][y];
+  }
+
+  // Whether the frame that just finished (see endFrame) differs from
+  // the one before it. When it doesn't, it wasn't rendered or
+  // presented again: the framebuffer still holds the same picture.
+  // With the worker running, sync() before reading this.
+  bool frameChanged;
+
+  // Frame hashing, for regression and determinism checks. Once it's
+  // on, every frame gets rendered, even ones the pacer skips
+  // presenting, and endFrame leaves a hash of the framebuffer (see
+  // framehash.hpp) in frameHash. frameCount counts frames finished
+  // since then. If `log` is given, each frame also gets a line there:
+  // its number and hash, in hex. Turn it on before emulation starts;
+  // with the worker running, sync() before reading these.
+  void hashFrames(FILE *log = NULL);
+  bool hashingFrames() { return hashing; }
+  uint64_t frameHash;
+  uint64_t frameCount;
+
+  // Call after changing VRAM or OAM at the given offset from its
+  // base, or after writing one of the display registers in
+  // ppu_registers.
+  void vramWritten(uint16_t offset);
+  void oamWritten(uint16_t offset);
+  void registerWritten(uint16_t addr, uint8_t value);
+  // Rebuild the whole cache, for when VRAM changes behind our back.
+  void decodeAllTiles();
+
+private:
+  CPU *cpu;
+  const pixel_kernels *kernels;
+
+  // What rendering reads: the CPU's own memory and registers, or the
+  // worker's copies of them.
+  const uint8_t *vram;
+  const uint8_t *oam;
+  ppu_registers regs;
+
+  bool useWorker;
+  std::thread worker;
+  std::atomic<bool> workerRunning;
+  PPUWriteLog log;
+  std::vector<uint8_t> workerVram;
+  std::vector<uint8_t> workerOam;
+
+  // The window has its own line counter: it only advances on lines
+  // where the window was actually drawn.
+  int windowLine;
+
+  // Bumped whenever VRAM or OAM changes.
+  uint64_t memoryVersion;
+  // Everything a line was last rendered from. If it all still
+  // matches, the line in the framebuffer is already right.
+  struct line_state {
+    uint64_t memoryVersion;
+    ppu_registers regs;
+    int windowLine;
+    int windowLineAfter;
+  };
+  line_state lineStates[SCREEN_HEIGHT];
+  // whether any line of the current frame was rendered
+  bool linesChanged;
+  // whether the framebuffer has changed since the video sink last got
+  // it
+  bool unpublished;
+
+  bool hashing;
+  FILE *hashLog;
+
+  uint8_t tileCache[2][N_TILES][8][8];
+
+  void loadRegisters();
+  void logWrite(uint16_t addr, uint8_t value);
+  void runWorker();
+  void replay(const ppu_write &w);
+
+  void finishFrame(bool present);
+  void drawLine(int line);
+  void decodeTileRow(int tile, int y);
+  int bgTile(uint16_t map_addr, bool tile_signed);
+  // BG and window fill in color indices, to go through the palette
+  // all at once; sprites write shades straight into the framebuffer,
+  // using the BG colors to tell where BG priority hides them.
+  void drawBackgroundLine(int line, uint8_t *colors);
+  void drawWindowLine(int line, uint8_t *colors);
+  int scanSprites(int line, int height, uint8_t *sprites);
+  void drawSpritesLine(int line, const uint8_t *bgColors, uint8_t *shades);
+};
+
+#endif // #ifndef PPU_H
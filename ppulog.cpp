@@ -0,0 +1,35 @@
+#include <thread>
+
+#include "ppulog.hpp"
+
+PPUWriteLog::PPUWriteLog()
+  : entries(PPU_LOG_ENTRIES), head(0), tail(0)
+{
+}
+
+void PPUWriteLog::push(const ppu_write &w) {
+  size_t h = head.load(std::memory_order_relaxed);
+  while (h - tail.load(std::memory_order_acquire) == entries.size()) {
+    std::this_thread::yield();
+  }
+  entries[h % entries.size()] = w;
+  head.store(h + 1, std::memory_order_release);
+}
+
+const ppu_write *PPUWriteLog::peek() {
+  size_t t = tail.load(std::memory_order_relaxed);
+  if (t == head.load(std::memory_order_acquire)) {
+    return NULL;
+  }
+  return &entries[t % entries.size()];
+}
+
+void PPUWriteLog::pop() {
+  tail.store(tail.load(std::memory_order_relaxed) + 1,
+             std::memory_order_release);
+}
+
+bool PPUWriteLog::empty() const {
+  return (head.load(std::memory_order_acquire) ==
+          tail.load(std::memory_order_acquire));
+}
@@ -0,0 +1,52 @@
+#ifndef PPULOG_H
+
+#define PPULOG_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Everything the PPU needs to know about, in the order it happened,
+// for rendering on another thread: writes to VRAM, OAM and the
+// display registers, plus markers for when each line is rendered and
+// each frame finished. Entries are stamped with the master clock
+// (CPU::cycles) at the time.
+struct ppu_write {
+  uint64_t cycle;
+  uint16_t addr; // bus address, or one of the markers below
+  uint8_t value;
+};
+
+// Marker addresses. Nothing the PPU cares about lives down here.
+const uint16_t PPU_LOG_LINE = 0x0000; // value: line to render
+const uint16_t PPU_LOG_FRAME = 0x0001; // value: whether to present it
+
+// Big enough for a frame that rewrites all of VRAM and OAM.
+const size_t PPU_LOG_ENTRIES = 1 << 14;
+
+// A single-producer, single-consumer ring of ppu_writes. The producer
+// (the emulation thread) never takes a lock; if the consumer falls a
+// whole log behind, push waits for room.
+class PPUWriteLog {
+public:
+  PPUWriteLog();
+
+  // Producer.
+  void push(const ppu_write &w);
+
+  // Consumer: look at the oldest entry, then drop it once it has been
+  // applied. empty() only becomes true after that.
+  const ppu_write *peek();
+  void pop();
+
+  bool empty() const;
+
+private:
+  std::vector<ppu_write> entries;
+  // Free-running counts; the index is the count mod the size.
+  std::atomic<size_t> head; // next to push
+  std::atomic<size_t> tail; // next to pop
+};
+
+#endif // #ifndef PPULOG_H
@@ -0,0 +1,56 @@
+#include <algorithm>
+#include <cstring>
+
+#include "samplering.hpp"
+
+SampleRing::SampleRing(size_t frames)
+  : samples(frames * 2, 0.0f), capacity(frames), head(0), tail(0),
+    overrunFrames(0), underrunFrames(0)
+{
+}
+
+void SampleRing::copyIn(size_t start, const float *in, size_t n) {
+  size_t pos = start % capacity;
+  size_t first = std::min(n, capacity - pos);
+  memcpy(&samples[pos * 2], in, first * 2 * sizeof(float));
+  memcpy(&samples[0], in + first * 2, (n - first) * 2 * sizeof(float));
+}
+
+void SampleRing::copyOut(size_t start, float *out, size_t n) const {
+  size_t pos = start % capacity;
+  size_t first = std::min(n, capacity - pos);
+  memcpy(out, &samples[pos * 2], first * 2 * sizeof(float));
+  memcpy(out + first * 2, &samples[0], (n - first) * 2 * sizeof(float));
+}
+
+size_t SampleRing::write(const float *frames, size_t n) {
+  size_t h = head.load(std::memory_order_relaxed);
+  size_t room = capacity - (h - tail.load(std::memory_order_acquire));
+  if (n > room) {
+    overrunFrames.fetch_add(n - room, std::memory_order_relaxed);
+    n = room;
+  }
+  copyIn(h, frames, n);
+  head.store(h + n, std::memory_order_release);
+  return n;
+}
+
+size_t SampleRing::read(float *out, size_t n) {
+  size_t t = tail.load(std::memory_order_relaxed);
+  size_t available = head.load(std::memory_order_acquire) - t;
+  if (n > available) {
+    underrunFrames.fetch_add(n - available, std::memory_order_relaxed);
+    n = available;
+  }
+  copyOut(t, out, n);
+  tail.store(t + n, std::memory_order_release);
+  return n;
+}
+
+size_t SampleRing::queued() const {
+  // Tail first, since it never passes head. The two can be from
+  // different moments, so the difference can overshoot a little.
+  size_t t = tail.load(std::memory_order_acquire);
+  size_t h = head.load(std::memory_order_acquire);
+  return std::min(h - t, capacity);
+}
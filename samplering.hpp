@@ -0,0 +1,50 @@
+#ifndef SAMPLERING_H
+
+#define SAMPLERING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Interleaved stereo frames, from the emulation thread to the audio
+// output callback. Single producer, single consumer, and wait-free on
+// both sides: neither ever takes a lock or waits for the other, which
+// the callback's real-time thread can't afford to. When the producer
+// is ahead, what doesn't fit is dropped (an overrun); when the
+// consumer is, it gets what there is (an underrun). Both are counted,
+// in frames.
+class SampleRing {
+public:
+  // Room for `frames` stereo frames.
+  SampleRing(size_t frames);
+
+  // Producer: queue up to n frames. Returns how many fit.
+  size_t write(const float *frames, size_t n);
+
+  // Consumer: take up to n frames. Returns how many there were.
+  size_t read(float *out, size_t n);
+
+  // Frames queued right now. Safe from either side.
+  size_t queued() const;
+
+  // Safe from any thread.
+  uint64_t overruns() const { return overrunFrames.load(); }
+  uint64_t underruns() const { return underrunFrames.load(); }
+
+private:
+  std::vector<float> samples;
+  size_t capacity; // in frames
+  // Free-running counts; the index is the count mod the capacity.
+  std::atomic<size_t> head; // next frame to write
+  std::atomic<size_t> tail; // next frame to read
+  std::atomic<uint64_t> overrunFrames;
+  std::atomic<uint64_t> underrunFrames;
+
+  // copy n frames between the ring at frame `start` and `out`,
+  // wrapping around
+  void copyIn(size_t start, const float *in, size_t n);
+  void copyOut(size_t start, float *out, size_t n) const;
+};
+
+#endif // #ifndef SAMPLERING_H
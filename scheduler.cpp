@@ -0,0 +1,60 @@
+#include <cassert>
+
+#include "scheduler.hpp"
+
+Scheduler::Scheduler()
+  : nextDeadline(SCHED_NEVER), nextEvent(N_SCHED_EVENTS)
+{
+  for (int i = 0; i < N_SCHED_EVENTS; i++) {
+    deadlines[i] = SCHED_NEVER;
+  }
+}
+
+void Scheduler::schedule(sched_event e, uint64_t when) {
+  assert(e < N_SCHED_EVENTS);
+  uint64_t old = deadlines[e];
+  deadlines[e] = when;
+  if ((when < nextDeadline) ||
+      ((when == nextDeadline) && (e < nextEvent))) {
+    nextDeadline = when;
+    nextEvent = e;
+  } else if ((e == nextEvent) && (when > old)) {
+    // the earliest event just got later; someone else may be first now
+    recompute();
+  }
+}
+
+void Scheduler::cancel(sched_event e) {
+  assert(e < N_SCHED_EVENTS);
+  deadlines[e] = SCHED_NEVER;
+  if (e == nextEvent) {
+    recompute();
+  }
+}
+
+bool Scheduler::pending(sched_event e) const {
+  return deadlines[e] != SCHED_NEVER;
+}
+
+uint64_t Scheduler::deadline(sched_event e) const {
+  return deadlines[e];
+}
+
+sched_event Scheduler::pop() {
+  assert(nextEvent < N_SCHED_EVENTS);
+  sched_event out = nextEvent;
+  deadlines[out] = SCHED_NEVER;
+  recompute();
+  return out;
+}
+
+void Scheduler::recompute() {
+  nextDeadline = SCHED_NEVER;
+  nextEvent = N_SCHED_EVENTS;
+  for (int i = 0; i < N_SCHED_EVENTS; i++) {
+    if (deadlines[i] < nextDeadline) {
+      nextDeadline = deadlines[i];
+      nextEvent = (sched_event) i;
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef SCHEDULER_H
+
+#define SCHEDULER_H
+
+#include <cstdint>
+
+// Everything that happens on its own schedule (rather than as a
+// direct result of an instruction) is an event on the CPU's master
+// clock. Each kind of event has at most one pending deadline, so the
+// queue is just a small array indexed by event kind, plus a cached
+// minimum so the CPU's hot loop only has to compare against one
+// number.
+
+enum sched_event {
+  EVENT_VBLANK,
+  EVENT_STAT,
+  EVENT_DISPLAY,
+  EVENT_TIMER,
+  EVENT_APU_FRAME,
+  EVENT_DMA,
+  EVENT_SERIAL,
+  N_SCHED_EVENTS
+};
+
+const uint64_t SCHED_NEVER = UINT64_MAX;
+
+class Scheduler {
+public:
+  Scheduler();
+
+  // Set (or move) the deadline for an event, in master clock cycles.
+  void schedule(sched_event e, uint64_t when);
+  void cancel(sched_event e);
+  bool pending(sched_event e) const;
+  uint64_t deadline(sched_event e) const;
+
+  // Deadline of the earliest pending event, or SCHED_NEVER.
+  uint64_t next() const { return nextDeadline; }
+
+  // Remove and return the earliest pending event. Ties go to the
+  // event with the lowest enum value. Only call this when something
+  // is pending.
+  sched_event pop();
+
+private:
+  void recompute();
+
+  uint64_t deadlines[N_SCHED_EVENTS];
+  uint64_t nextDeadline;
+  sched_event nextEvent;
+};
+
+#endif // #ifndef SCHEDULER_H
@@ -4,12 +4,14 @@
 #include <sstream>
 #include <fstream>
 #include <cassert>
+#include <cstring>
 #include <stdnoreturn.h>
 
 #include <unistd.h>
 #include <sys/param.h>
 
 #include "screen.hpp"
+#include "debugview.hpp"
 #include "mem.hpp"
 
 const char *PROGRAM_NAME = "Spearow";
@@ -20,6 +22,17 @@ const char *FRAGMENT_SHADER_FILE = "fragment.frag";
 #define STRINGIZE(x) INNER_STRINGIZE(x)
 #define checkGlErrors(cont) \
   (_checkGlErrors(cont, __FILE__ ":" STRINGIZE(__LINE__)))
+// glGetError can stall the pipeline, so per-frame code only checks
+// when GL_DEBUG is set. Setup code always checks.
+#define checkGlErrorsDebug(cont) \
+  do { if (GL_DEBUG) { checkGlErrors(cont); } } while (0)
+
+// The screen is drawn as one textured quad, as two triangles in
+// texture coordinates.
+static const vertex QUAD[6] = {
+  {0.0, 0.0}, {0.0, 1.0}, {1.0, 1.0},
+  {0.0, 0.0}, {1.0, 1.0}, {1.0, 0.0}
+};
 
 noreturn void die(void) {
   glfwTerminate();
@@ -57,8 +70,10 @@ void _checkGlErrors(int continue_after_err,
   }
 }
 
-Screen::Screen(CPU *c, bool vsyncParam, bool displayTiles)
-  : vsync(vsyncParam), cpu(c), tileWindow(NULL)
+Screen::Screen(CPU *c, bool vsyncParam, int debugViewEvery)
+  : frames(SCREEN_WIDTH * SCREEN_HEIGHT),
+    buttonsPressed(0), directionsPressed(0),
+    vsync(vsyncParam), cpu(c), debugViews(NULL), debugWindow(NULL)
 {
   // Bit of a hack here: initializing the window will change the
   // working directory for some reason, so store it and change it back
@@ -87,12 +102,18 @@ Screen::Screen(CPU *c, bool vsyncParam, bool displayTiles)
   initShaders();
 
 
+  // Everything the main window draws with is set up once, here.
   glGenBuffers(1, &bgVbo);
+  initQuad(bgVbo);
   glGenTextures(1, &texName);
+  initTexture(texName, GL_TEXTURE0, SCREEN_WIDTH, SCREEN_HEIGHT);
+  glGenBuffers(1, &pbo);
 
   checkGlErrors(0);
 
   glfwSetInputMode(window, GLFW_STICKY_KEYS, 1);
+  glfwSetWindowUserPointer(window, this);
+  glfwSetKeyCallback(window, keyCallback);
 
   glClearColor(0.0,0.0,0.0,0.0);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -105,322 +126,159 @@ Screen::Screen(CPU *c, bool vsyncParam, bool displayTiles)
     glfwSwapInterval(0);
   }
 
-  if (displayTiles) {
-    initTileWindow();
+  if (debugViewEvery) {
+    debugViews = new DebugViews(debugViewEvery);
+    initDebugWindow();
   }
 }
 
-void Screen::draw() {
-  // switch contexts here, but don't bother unless we actually have
-  // multiple contexts to switch between.
-  if (tileWindow) {
-    glfwMakeContextCurrent(window);
-  }
-  drawMainWindow();
-
-  if (tileWindow) {
-    glfwMakeContextCurrent(tileWindow);
-    drawTileWindow();
-  }
-}
-
-void Screen::drawMainWindow() {
-  // start slow, make it work
-
-  float pixels[144*160];
-
-  if (cpu->lcd_control & LCDC_BG_DISPLAY) {
-    drawBackground(pixels);
-  }
-
-  if (cpu->lcd_control & LCDC_WINDOW_DISPLAY) {
-    drawWindow(pixels);
-  }
-
-  if (cpu->lcd_control & LCDC_SPRITE_DISPLAY) {
-    drawSprites(pixels);
-  }
-
-  glBindVertexArray(bgVao);
-  checkGlErrors(0);
-
-  glBindBuffer(GL_ARRAY_BUFFER, bgVbo);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, texName);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, 160, 144,
-               0, GL_RED, GL_FLOAT, pixels);
-  checkGlErrors(0);
-
-  glClearColor(0.0,0.0,0.0,0.0);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  // TODO what does this do again?
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  checkGlErrors(0);
-
-  glActiveTexture(GL_TEXTURE0);
-  checkGlErrors(0);
-  glBindTexture(GL_TEXTURE_2D, texName); // do we need this twice?
-  checkGlErrors(0);
-
-  vertex vs[6];
-  vs[0] = {0.0,0.0};
-  vs[1] = {0.0,1.0};
-  vs[2] = {1.0,1.0};
-  vs[3] = {0.0,0.0};
-  vs[4] = {1.0,1.0};
-  vs[5] = {1.0,0.0};
-
-  int stride = sizeof(vertex);
-  glBufferData(GL_ARRAY_BUFFER, 6 * stride, vs, GL_DYNAMIC_DRAW);
-  checkGlErrors(0);
+void Screen::initQuad(GLuint vbo) {
+  // Needs the right vertex array bound: it records the attribute
+  // setup, so drawing only has to bind it again.
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD), QUAD, GL_STATIC_DRAW);
   glVertexAttribPointer(posAttrib, 2,
-                        GL_FLOAT, GL_FALSE, stride,
+                        GL_FLOAT, GL_FALSE, sizeof(vertex),
                         (const GLvoid *) offsetof(vertex, x));
   glEnableVertexAttribArray(posAttrib);
   checkGlErrors(0);
-  glUniform1i(texUniform, 0); // 0 corresponds to GL_TEXTURE0
-  checkGlErrors(0);
+}
 
-  glDrawArrays(GL_TRIANGLES, 0, 6);
+void Screen::initTexture(GLuint tex, GLenum unit, int width, int height) {
+  // Allocate the storage once; frames only ever replace its contents.
+  glActiveTexture(unit);
+  glBindTexture(GL_TEXTURE_2D, tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height,
+               0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  // no smoothing: keep pixels square
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
   checkGlErrors(0);
-
-  glfwSwapBuffers(window);
-  glfwPollEvents();
-  if (glfwWindowShouldClose(window)) {
-    die();
-  }
 }
 
-void Screen::drawBackground(float *pixels) {
-  const uint16_t bg_base = (cpu->lcd_control & LCDC_BG_CODE)
-    ? 0x9c00 : 0x9800;
-  const bool tile_signed = !(cpu->lcd_control & LCDC_BG_CHR);
-  const uint16_t tile_base = tile_signed ? 0x9000 : 0x8000;
-
-  for (int screenY = 0; screenY < 144; screenY++) {
-    int scrollspaceY = (screenY + cpu->scroll_y) % 256;
-    int tileY = scrollspaceY / 8;
-    for (int screenX = 0; screenX < 160; screenX++) {
-      int scrollspaceX = (screenX + cpu->scroll_x) % 256;
-
-      int tileX = scrollspaceX / 8;
-      int block = tileY * 32 + tileX;
-
-      uint8_t tile_code = gb_mem_ptr(*cpu, bg_base + block).read();
-      int tile_n = tile_signed ? (int8_t) tile_code : tile_code;
-
-      uint16_t tile_addr = tile_base + tile_n * 16;
-
-      uint8_t low_byte = gb_mem_ptr(*cpu,
-                                    tile_addr + (scrollspaceY%8)*2).read();
-      uint8_t high_byte = gb_mem_ptr(*cpu,
-                                     tile_addr + (scrollspaceY%8)*2 + 1).read();
-
-      int out = 0;
-      if (low_byte & (1<<(7-(scrollspaceX%8)))) {
-        out += 1;
-      }
-      if (high_byte & (1<<(7-(scrollspaceX%8)))) {
-        out += 2;
-      }
-
-      int shade = 3 - ((cpu->bg_palette & (3 << (out*2))) >> (out*2));
+void Screen::publishFrame(const uint8_t *shades) {
+  // Emulation thread. Copy out everything the presentation thread
+  // will need, so it never touches emulator state.
+  memcpy(frames.writeBuffer(), shades, frames.size());
+  frames.publish();
+}
 
-      pixels[screenX + (screenY*160)] = shade / 3.0;
-    }
+void Screen::vblank() {
+  // Emulation thread, so the CPU's own VRAM and registers are
+  // current, even with the PPU on a worker.
+  if (debugViews) {
+    const ppu_registers regs = {
+      cpu->lcd_control, cpu->scroll_y, cpu->scroll_x, cpu->bg_palette,
+      cpu->obj_palette_0, cpu->obj_palette_1, cpu->window_y, cpu->window_x
+    };
+    debugViews->vblank(cpu->vram, cpu->oam, regs);
   }
 }
 
-void Screen::drawSprites(float *pixels) {
-  const uint16_t tile_base = 0x8000;
-  const bool big_sprites = !!(cpu->lcd_control & LCDC_SPRITE_SIZE);
-
-  // TODO handle overlapping sprites
-  // TODO handle sprite-per-scanline limitation
-
-  for (int i = 0; i < OAM_N_SPRITES; i++) {
-    uint16_t sprite_base = OAM_BASE + i * SPRITE_SIZE;
-    uint8_t y = gb_mem_ptr(*cpu, sprite_base + 0).read();
-    uint8_t x = gb_mem_ptr(*cpu, sprite_base + 1).read();
-    uint8_t chr = gb_mem_ptr(*cpu, sprite_base + 2).read();
-    if (big_sprites) {
-      // clear least-significant bit
-      chr &= ~1;
+void Screen::present() {
+  // Presentation thread. The debug window keeps its own schedule:
+  // it's only drawn when the views have something new, which they
+  // only do while it's showing.
+  if (debugWindow) {
+    if (glfwWindowShouldClose(debugWindow)) {
+      // closing it just hides it
+      glfwSetWindowShouldClose(debugWindow, 0);
+      toggleDebugWindow();
     }
-    uint8_t flags = gb_mem_ptr(*cpu, sprite_base + 3).read();
-
-    uint16_t tile_addr = tile_base + chr * 16;
-
-    bool priority = !!(flags & SPRITE_PRIORITY);
-    bool flipVert = !!(flags & SPRITE_FLIP_V);
-    bool flipHoriz = !!(flags & SPRITE_FLIP_H);
-    uint8_t palette = (flags & SPRITE_PALETTE) ? cpu->obj_palette_1 : cpu->obj_palette_0;
-    int color = flags & SPRITE_COLOR;
-
-    int top = y - SPRITE_Y_OFFSET;
-    int left = x - SPRITE_X_OFFSET;
-    int height = big_sprites ? 16 : 8;
-    for (int screenY = top; screenY < top + height; screenY++) {
-      if ((screenY < 0) || (screenY >= SCREEN_HEIGHT)) {
-        continue;
-      }
-      int dy = flipVert ? (height - 1) - (screenY - top) : screenY - top;
-      for (int screenX = left; screenX < left + 8; screenX++) {
-        if ((screenX < 0) || (screenX >= SCREEN_WIDTH)) {
-          continue;
-        }
-        int dx = flipHoriz ? (7 - (screenX - left)) : (screenX - left);
-
-        uint8_t low_byte = gb_mem_ptr(*cpu, tile_addr + (dy%8)*2).read();
-        uint8_t high_byte = gb_mem_ptr(*cpu, tile_addr + (dy%8)*2 + 1).read();
-
-        int pixel = 0;
-        if (low_byte & (1<<(7-(dx%8)))) {
-          pixel += 1;
-        }
-        if (high_byte & (1<<(7-(dx%8)))) {
-          pixel += 2;
-        }
-        if (pixel) { // color 0 is transparent
-          int shade = 3 - ((palette & (3 << (pixel*2))) >> (pixel*2));
-          // TODO test priority and bg pixel
-          pixels[screenX + (screenY*160)] = shade / 3.0;
-        }
-      }
+    debugViews->setVisible(glfwGetWindowAttrib(debugWindow, GLFW_VISIBLE) &&
+                           !glfwGetWindowAttrib(debugWindow, GLFW_ICONIFIED));
+    if (debugViews->update()) {
+      glfwMakeContextCurrent(debugWindow);
+      drawDebugWindow();
+      glfwMakeContextCurrent(window);
     }
   }
-}
 
-void Screen::drawWindow(float *pixels) {
-  const uint16_t bg_base = (cpu->lcd_control & LCDC_WINDOW_CODE)
-    ? 0x9c00 : 0x9800;
-  const bool tile_signed = !(cpu->lcd_control & LCDC_BG_CHR);
-  const uint16_t tile_base = tile_signed ? 0x9000 : 0x8000;
-
-  int screenTop = cpu->window_y;
-  int screenLeft = cpu->window_x - 7;
-  if ((screenTop >= SCREEN_HEIGHT) ||
-      (screenLeft < 0) ||
-      (screenLeft >= SCREEN_WIDTH)) {
+  if (!frames.update()) {
+    // Nothing new to show. Wait a little, handling any input that
+    // comes in meanwhile, and check again.
+    glfwWaitEventsTimeout(PRESENT_POLL_SECONDS);
+    if (glfwWindowShouldClose(window)) {
+      die();
+    }
     return;
   }
-  for (int y = screenTop; y < SCREEN_HEIGHT; y++) {
-    int tileY = (y - screenTop) / 8;
-    for (int x = screenLeft; x < SCREEN_WIDTH; x++) {
-      int tileX = (x - screenLeft) / 8;
-      int block = tileY * 32 + tileX;
-
-      uint8_t tile_code = gb_mem_ptr(*cpu, bg_base + block).read();
-      int tile_n = tile_signed ? (int8_t) tile_code : tile_code;
-
-      uint16_t tile_addr = tile_base + tile_n * 16;
-
-      uint8_t low_byte = gb_mem_ptr(*cpu, tile_addr + (y%8)*2).read();
-      uint8_t high_byte = gb_mem_ptr(*cpu, tile_addr + (y%8)*2 + 1).read();
-
-      int out = 0;
-      if (low_byte & (1<<(7-(x%8)))) {
-        out += 1;
-      }
-      if (high_byte & (1<<(7-(x%8)))) {
-        out += 2;
-      }
-
-      // window uses bg palette
-      int shade = 3 - ((cpu->bg_palette & (3 << (out*2))) >> (out*2));
+  drawMainWindow();
+}
 
-      pixels[x + (y*160)] = shade / 3.0;
-    }
+void Screen::presentLoop() {
+  while (1) {
+    present();
   }
 }
 
-void Screen::drawTileWindow() {
-  const uint16_t tile_base = 0x8000;
-  const uint16_t n_tiles = (0x9800 - 0x8000) / 16;
-
-  // Display a 16*24 window of tiles
-
-  float pixels[16*8*24*8];
-
-  for (int y = 0; y < 24*8; y++) {
-    int tileY = y / 8;
-    for (int x = 0; x < 16*8; x++) {
-      int tileX = x / 8;
-
-      int tile_n = tileX + tileY * 16;
-      assert(tile_n < n_tiles);
-
-      uint16_t tile_addr = tile_base + tile_n * 16;
+void Screen::drawMainWindow() {
+  // The PPU has already rendered the frame line by line; all that's
+  // left is to put it on the screen. Convert it straight into the
+  // pixel buffer, then let GL copy it into the texture from there.
+  const GLsizeiptr frameBytes = SCREEN_WIDTH * SCREEN_HEIGHT * 4;
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+  // Orphan last frame's storage, so we never wait on GL still reading
+  // from it.
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, frameBytes, NULL, GL_STREAM_DRAW);
+  void *pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, frameBytes,
+                                  GL_MAP_WRITE_BIT |
+                                  GL_MAP_INVALIDATE_BUFFER_BIT);
+  if (pixels) {
+    palette.convert(frames.readBuffer(), frames.size(),
+                    PIXEL_RGBA8888, pixels);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texName);
+    // with a PBO bound, the last argument is an offset into it
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT,
+                    GL_RGBA, GL_UNSIGNED_BYTE, 0);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-      uint8_t low_byte = gb_mem_ptr(*cpu, tile_addr + (y%8)*2).read();
-      uint8_t high_byte = gb_mem_ptr(*cpu, tile_addr + (y%8)*2 + 1).read();
+  glBindVertexArray(bgVao);
+  glUniform1i(texUniform, 0); // 0 corresponds to GL_TEXTURE0
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+  checkGlErrorsDebug(0);
 
-      int out = 0;
-      if (low_byte & (1<<(7-(x%8)))) {
-        out += 1;
-      }
-      if (high_byte & (1<<(7-(x%8)))) {
-        out += 2;
-      }
-      pixels[x + (y*16*8)] = out / 3.0;
-    }
+  glfwSwapBuffers(window);
+  glfwPollEvents();
+  if (glfwWindowShouldClose(window)) {
+    die();
   }
+}
 
-  glBindVertexArray(tileVao);
-  checkGlErrors(0);
-
-  glBindBuffer(GL_ARRAY_BUFFER, tileVbo);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, tileWindowTexName);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, 16*8, 24*8,
-               0, GL_RED, GL_FLOAT, pixels);
-  checkGlErrors(0);
-
-  glClearColor(0.0,0.0,0.0,0.0);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-  // TODO what does this do again?
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  checkGlErrors(0);
+void Screen::drawDebugWindow() {
+  static uint8_t pixels[DEBUG_VIEW_WIDTH * DEBUG_VIEW_HEIGHT * 4];
+  palette.convert(debugViews->image(), DEBUG_VIEW_WIDTH * DEBUG_VIEW_HEIGHT,
+                  PIXEL_RGBA8888, pixels);
 
+  // This is a debug view, so it doesn't bother with a PBO.
   glActiveTexture(GL_TEXTURE1);
-  checkGlErrors(0);
-  glBindTexture(GL_TEXTURE_2D, tileWindowTexName); // do we need this twice?
-  checkGlErrors(0);
-
-  vertex vs[6];
-  vs[0] = {0.0,0.0};
-  vs[1] = {0.0,1.0};
-  vs[2] = {1.0,1.0};
-  vs[3] = {0.0,0.0};
-  vs[4] = {1.0,1.0};
-  vs[5] = {1.0,0.0};
-
-  int stride = sizeof(vertex);
-  glBufferData(GL_ARRAY_BUFFER, 6 * stride, vs, GL_DYNAMIC_DRAW);
-  checkGlErrors(0);
-  glVertexAttribPointer(posAttrib, 2,
-                        GL_FLOAT, GL_FALSE, stride,
-                        (const GLvoid *) offsetof(vertex, x));
-  checkGlErrors(0);
-  glEnableVertexAttribArray(posAttrib);
-  checkGlErrors(0);
+  glBindTexture(GL_TEXTURE_2D, debugWindowTexName);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+                  DEBUG_VIEW_WIDTH, DEBUG_VIEW_HEIGHT,
+                  GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 
+  glBindVertexArray(debugVao);
   glUseProgram(shader); // why do I need this here? it is a mystery
   glUniform1i(texUniform, 1); // 1 corresponds to GL_TEXTURE1
-  checkGlErrors(0);
-
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   glDrawArrays(GL_TRIANGLES, 0, 6);
-  checkGlErrors(0);
+  checkGlErrorsDebug(0);
 
+  glfwSwapBuffers(debugWindow);
+}
 
-  glfwSwapBuffers(tileWindow);
-  glfwPollEvents();
-  if (glfwWindowShouldClose(tileWindow)) {
-    die();
+void Screen::toggleDebugWindow() {
+  if (!debugWindow) {
+    return;
+  }
+  if (glfwGetWindowAttrib(debugWindow, GLFW_VISIBLE)) {
+    glfwHideWindow(debugWindow);
+  } else {
+    glfwShowWindow(debugWindow);
   }
 }
 
@@ -459,7 +317,7 @@ int initWindow(GLFWwindow **window_p) {
   return 0;
 }
 
-void Screen::initTileWindow() {
+void Screen::initDebugWindow() {
   // TODO refactor this, initWindow, and constructor. code reuse is
   // weird here.
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -468,31 +326,35 @@ void Screen::initTileWindow() {
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
   /* Create a windowed mode window and its OpenGL context */
-  const static char *tileWindowName = "Tiles";
-  const int tileWindowWidth = 16*8*2;
-  const int tileWindowHeight = 20*8*2;
-  tileWindow = glfwCreateWindow(tileWindowWidth, tileWindowHeight,
-                                tileWindowName, NULL,
-                                // share context with existing window
-                                window);
-  if (!tileWindow)
+  const static char *debugWindowName = "Debug views";
+  const int debugWindowWidth = DEBUG_VIEW_WIDTH*2;
+  const int debugWindowHeight = DEBUG_VIEW_HEIGHT*2;
+  debugWindow = glfwCreateWindow(debugWindowWidth, debugWindowHeight,
+                                 debugWindowName, NULL,
+                                 // share context with existing window
+                                 window);
+  if (!debugWindow)
     {
       std::cerr << "glfwCreateWindow failed\n";
       glfwTerminate();
     }
 
-  if (glfwGetWindowAttrib(tileWindow, GLFW_CONTEXT_VERSION_MAJOR) < 3) {
+  if (glfwGetWindowAttrib(debugWindow, GLFW_CONTEXT_VERSION_MAJOR) < 3) {
     std::cerr << "initWindow: Error: GL major version too low\n";
     die();
   }
 
-  // move tile window so it doesn't overlap with main window
+  // move debug window so it doesn't overlap with main window
   int mainX, mainY;
 
   glfwGetWindowPos(window, &mainX, &mainY);
-  glfwSetWindowPos(tileWindow, mainX - tileWindowWidth - 20, mainY);
+  glfwSetWindowPos(debugWindow, mainX, mainY + SCREEN_HEIGHT*2 + 40);
+
+  // keys work in either window
+  glfwSetWindowUserPointer(debugWindow, this);
+  glfwSetKeyCallback(debugWindow, keyCallback);
 
-  glfwMakeContextCurrent(tileWindow);
+  glfwMakeContextCurrent(debugWindow);
 
   if (!vsync) {
     glfwSwapInterval(0);
@@ -504,14 +366,17 @@ void Screen::initTileWindow() {
   glfwPollEvents();
   checkGlErrors(0);
 
-  glGenVertexArrays(1, &tileVao);
+  glGenVertexArrays(1, &debugVao);
   checkGlErrors(0);
 
-  glBindVertexArray(tileVao);
+  glBindVertexArray(debugVao);
   checkGlErrors(0);
 
-  glGenBuffers(1, &tileVbo);
-  glGenTextures(1, &tileWindowTexName);
+  glGenBuffers(1, &debugVbo);
+  initQuad(debugVbo);
+  glGenTextures(1, &debugWindowTexName);
+  initTexture(debugWindowTexName, GL_TEXTURE1,
+              DEBUG_VIEW_WIDTH, DEBUG_VIEW_HEIGHT);
   checkGlErrors(0);
 
   // not sure exactly how much is shared between the windows - they
@@ -519,6 +384,8 @@ void Screen::initTileWindow() {
   // the shader program again
   glUseProgram(shader);
   checkGlErrors(0);
+
+  glfwMakeContextCurrent(window);
 }
 
 GLint safeGetAttribLocation(GLuint program, const GLchar *name) {
@@ -640,41 +507,92 @@ void Screen::initShaders(void) {
   texUniform = safeGetUniformLocation(shader, "tex");
 }
 
-uint8_t Screen::getKeys(uint8_t inputFlags) {
-  // COMPAT: I'm not sure what happens when both JOYPAD_DIRECTIONS and
-  // JOYPAD_BUTTONS bits are set low. This is just a guess.
+// Gameboy buttons: arrow keys, s for A, a for B, backslash for
+// select, enter for start. Emulator hotkeys: tab toggles turbo, - and
+// = step the speed down and up, 0 resets it, v switches between video
+// and audio sync, d shows or hides the debug window.
+void Screen::keyCallback(GLFWwindow *w, int key, int scancode,
+                         int action, int mods) {
+  if (action == GLFW_REPEAT) {
+    return;
+  }
+  Screen *screen = (Screen *) glfwGetWindowUserPointer(w);
+  bool pressed = (action == GLFW_PRESS);
+
+  // The emulator reads these from its own thread (see getKeys).
+  std::atomic<uint8_t> *keys = NULL;
+  uint8_t bit = 0;
+  switch (key) {
+  case GLFW_KEY_RIGHT:
+    keys = &screen->directionsPressed; bit = JOYPAD_RIGHT; break;
+  case GLFW_KEY_LEFT:
+    keys = &screen->directionsPressed; bit = JOYPAD_LEFT; break;
+  case GLFW_KEY_UP:
+    keys = &screen->directionsPressed; bit = JOYPAD_UP; break;
+  case GLFW_KEY_DOWN:
+    keys = &screen->directionsPressed; bit = JOYPAD_DOWN; break;
+  case GLFW_KEY_S:
+    keys = &screen->buttonsPressed; bit = JOYPAD_A; break;
+  case GLFW_KEY_A:
+    keys = &screen->buttonsPressed; bit = JOYPAD_B; break;
+  case GLFW_KEY_BACKSLASH:
+    keys = &screen->buttonsPressed; bit = JOYPAD_SELECT; break;
+  case GLFW_KEY_ENTER:
+    keys = &screen->buttonsPressed; bit = JOYPAD_START; break;
+  }
+  if (keys) {
+    if (pressed) {
+      *keys |= bit;
+    } else {
+      *keys &= ~bit;
+    }
+    return;
+  }
 
-  // COMPAT: Unclear what the top nibble of this should be. Guessing
-  // it can be 0 for now.
+  if (!pressed) {
+    return;
+  }
+  FramePacer &pacer = screen->cpu->pacer;
+  switch (key) {
+  case GLFW_KEY_TAB:
+    pacer.toggleTurbo();
+    break;
+  case GLFW_KEY_MINUS:
+    pacer.slower();
+    break;
+  case GLFW_KEY_EQUAL:
+    pacer.faster();
+    break;
+  case GLFW_KEY_0:
+    pacer.setSpeed(PACER_NORMAL_SPEED);
+    break;
+  case GLFW_KEY_V:
+    pacer.toggleSync();
+    break;
+  case GLFW_KEY_D:
+    screen->toggleDebugWindow();
+    return;
+  default:
+    return;
+  }
+  screen->updateTitle();
+}
 
-  uint8_t out = 0xf;
-  if (!(inputFlags & JOYPAD_DIRECTIONS)) {
-    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-      out &= ~JOYPAD_RIGHT;
-    }
-    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-      out &= ~JOYPAD_LEFT;
-    }
-    if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-      out &= ~JOYPAD_UP;
-    }
-    if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-      out &= ~JOYPAD_DOWN;
-    }
+void Screen::updateTitle() {
+  int speed = cpu->pacer.getSpeed();
+  std::stringstream title;
+  title << PROGRAM_NAME;
+  if (speed == PACER_UNCAPPED) {
+    title << " (uncapped)";
+  } else if (speed != PACER_NORMAL_SPEED) {
+    title << " (" << PACER_SPEEDS[speed] << "x)";
   }
-  if (!(inputFlags & JOYPAD_BUTTONS)) {
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-      out &= ~JOYPAD_A;
-    }
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-      out &= ~JOYPAD_B;
-    }
-    if (glfwGetKey(window, GLFW_KEY_BACKSLASH) == GLFW_PRESS) {
-      out &= ~JOYPAD_SELECT;
-    }
-    if (glfwGetKey(window, GLFW_KEY_ENTER) == GLFW_PRESS) {
-      out &= ~JOYPAD_START;
-    }
+  if (cpu->pacer.getSync() == PACE_AUDIO) {
+    title << " [audio sync]";
   }
-  return out;
+  glfwSetWindowTitle(window, title.str().c_str());
+}
+
+uint8_t Screen::getKeys(uint8_t inputFlags) {
+  return joypadBits(inputFlags, buttonsPressed, directionsPressed);
 }
@@ -0,0 +1,84 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "shmvideo.hpp"
+#include "ppu.hpp"
+
+static_assert(sizeof(shm_video_header) <= SHM_VIDEO_FRAME_OFFSET,
+              "shared video header overlaps the frame");
+
+ShmVideo::ShmVideo(const char *name)
+  : name(name),
+    size(SHM_VIDEO_FRAME_OFFSET + SCREEN_WIDTH * SCREEN_HEIGHT),
+    shared(NULL), linked(0)
+{
+  // Never attach to an object someone else made: it could be another
+  // instance's, still in use.
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if ((fd < 0) && (errno == EEXIST)) {
+    fprintf(stderr, "Shared memory %s already exists. Is another spearow "
+            "using it? If not, remove /dev/shm%s.\n", name, name);
+    exit(-1);
+  }
+  if (fd < 0) {
+    perror(name);
+    exit(-1);
+  }
+  linked = 1;
+  if (ftruncate(fd, size) != 0) {
+    perror(name);
+    unlink();
+    exit(-1);
+  }
+  void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    perror(name);
+    unlink();
+    exit(-1);
+  }
+  memset(mapped, 0, size);
+
+  shared = new (mapped) shm_video_header;
+  shared->sequence = 0;
+  shared->width = SCREEN_WIDTH;
+  shared->height = SCREEN_HEIGHT;
+  shared->buttons = 0;
+  shared->directions = 0;
+  // last, so a reader that sees the magic sees the rest
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(shared->magic, SHM_VIDEO_MAGIC, sizeof(shared->magic));
+}
+
+ShmVideo::~ShmVideo() {
+  munmap(shared, size);
+  unlink();
+}
+
+void ShmVideo::unlink() {
+  if (linked) {
+    shm_unlink(name);
+    linked = 0;
+  }
+}
+
+void ShmVideo::publishFrame(const uint8_t *shades) {
+  uint64_t sequence = shared->sequence.load(std::memory_order_relaxed);
+  shared->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy((uint8_t *) shared + SHM_VIDEO_FRAME_OFFSET, shades,
+         SCREEN_WIDTH * SCREEN_HEIGHT);
+  shared->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+uint8_t ShmVideo::getKeys(uint8_t inputFlags) {
+  return joypadBits(inputFlags, shared->buttons, shared->directions);
+}
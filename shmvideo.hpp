@@ -0,0 +1,65 @@
+#ifndef SHMVIDEO_H
+
+#define SHMVIDEO_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "videosink.hpp"
+
+// Publishes frames through a POSIX shared memory object (shm_open),
+// for another process to display, stream or check. The object holds
+// a shm_video_header, then at SHM_VIDEO_FRAME_OFFSET the newest frame:
+// width * height shades, 0 (lightest) to 3 (darkest), row-major.
+//
+// The frame is guarded by a sequence lock. The sequence is odd while
+// a frame is being written and even once it's complete, so a reader
+// copies the frame out between two reads of the sequence, and keeps
+// the copy if both were the same even number. The reader can also
+// press buttons by setting JOYPAD_* bits in buttons and directions.
+//
+// The object is created when the sink is, and it's an error if it
+// already exists. It's removed by unlink() or when the sink is
+// destroyed; readers that have it mapped keep their mapping.
+
+const char SHM_VIDEO_MAGIC[8] = {'S', 'P', 'R', 'W', 'V', 'I', 'D', '1'};
+const size_t SHM_VIDEO_FRAME_OFFSET = 64;
+
+struct shm_video_header {
+  char magic[8];
+  std::atomic<uint64_t> sequence;
+  uint32_t width;
+  uint32_t height;
+  std::atomic<uint8_t> buttons;
+  std::atomic<uint8_t> directions;
+};
+
+class ShmVideo : public VideoSink {
+public:
+  // Exits if the object can't be created, or already exists.
+  ShmVideo(const char *name);
+  ~ShmVideo();
+
+  // Remove the object's name now, for when the sink won't be
+  // destroyed (spearow exits without destroying it). Frames can
+  // still be published.
+  void unlink();
+
+  void publishFrame(const uint8_t *shades);
+  uint8_t getKeys(uint8_t inputFlags);
+
+  // The mapping, for whatever wants to look at it from this side.
+  const shm_video_header *header() const { return shared; }
+  const uint8_t *frame() const {
+    return (const uint8_t *) shared + SHM_VIDEO_FRAME_OFFSET;
+  }
+
+private:
+  const char *name;
+  size_t size;
+  shm_video_header *shared;
+  bool linked;
+};
+
+#endif // #ifndef SHMVIDEO_H
@@ -1,10 +1,13 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
 #include <vector>
 #include <algorithm> // std::sort
 #include <numeric> // std::iota
+#include <thread>
 
 #include <getopt.h> // getopt_long
 
@@ -12,6 +15,9 @@
 #include "mem.hpp"
 #include "opcodes.hpp"
 #include "debugger.hpp"
+#include "capture.hpp"
+#include "debugview.hpp"
+#include "shmvideo.hpp"
 
 void runFiniteInstrs(CPU &cpu,
                      unsigned long long instrs,
@@ -56,7 +62,11 @@ void usage(int argc, char **argv, struct option *opts) {
 
   printf("usage: %s", programname);
   for (int i = 0; opts[i].name; i++) {
-    printf(" [--%s]", opts[i].name);
+    if (opts[i].has_arg == required_argument) {
+      printf(" [--%s arg]", opts[i].name);
+    } else {
+      printf(" [--%s]", opts[i].name);
+    }
   }
 
   printf(" file\n");
@@ -65,13 +75,52 @@ void usage(int argc, char **argv, struct option *opts) {
 int main(int argc, char **argv) {
   int debug = 0;
   int displayTiles = 0;
+  int debugViewEvery = DEBUG_VIEW_EVERY;
+  video_config video;
+  video.backend = VIDEO_GL;
   int vsync = 1;
+  int pacingStats = 0;
+  int ppuThread = 0;
+  int frameskip = 0;
+  const char *capturePath = NULL;
+  capture_format captureFormat = CAPTURE_Y4M;
+  int captureEvery = 1;
+  Upscaler captureScale;
+  const char *hashLogPath = NULL;
+  int speed = PACER_NORMAL_SPEED;
+  pacer_sync sync = PACE_VIDEO;
 
   static struct option opts[] = {
     {"help", no_argument, NULL, 'h'},
     {"debug", no_argument, &debug, 1},
+    // tiles, tile maps, sprites and palettes, in a second window
     {"display-tiles", no_argument, &displayTiles, 1},
+    // refresh those every N frames
+    {"debug-view-every", required_argument, NULL, 'd'},
     {"no-vsync", no_argument, &vsync, 0},
+    // gl (a window), null (headless) or shm (shared memory)
+    {"video", required_argument, NULL, 'V'},
+    // shared memory object for --video shm
+    {"shm-name", required_argument, NULL, 'n'},
+    // 0.25, 0.5, 1, 2, 4, 8 or uncapped
+    {"speed", required_argument, NULL, 's'},
+    {"pacing-stats", no_argument, &pacingStats, 1},
+    // write rendered frames to a file, or - for stdout
+    {"capture", required_argument, NULL, 'c'},
+    // y4m, raw (RGBA) or tiles (compact; see spearow-decode)
+    {"capture-format", required_argument, NULL, 'F'},
+    // only keep every Nth rendered frame
+    {"capture-every", required_argument, NULL, 'e'},
+    // 1x-8x (nearest neighbour), scale2x, scale3x or epx
+    {"capture-scale", required_argument, NULL, 'S'},
+    // log a hash of every frame, or - for stdout
+    {"hash-log", required_argument, NULL, 'H'},
+    // frames to skip after each one rendered, or auto
+    {"frameskip", required_argument, NULL, 'k'},
+    // render on a second core
+    {"ppu-thread", no_argument, &ppuThread, 1},
+    // video (host clock) or audio (output queue)
+    {"sync", required_argument, NULL, 'y'},
     {0, 0, 0, 0}
   };
 
@@ -81,6 +130,71 @@ int main(int argc, char **argv) {
     switch (c) {
     case 0:
       break;
+    case 's':
+      speed = FramePacer::parseSpeed(optarg);
+      if (speed < 0) {
+        fprintf(stderr, "Unsupported speed %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'V':
+      if (!VideoSink::parseBackend(optarg, &video.backend)) {
+        fprintf(stderr, "Unknown video backend %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'n':
+      video.shmName = optarg;
+      break;
+    case 'd':
+      debugViewEvery = atoi(optarg);
+      if (debugViewEvery < 1) {
+        fprintf(stderr, "Bad debug view interval %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'c':
+      capturePath = optarg;
+      break;
+    case 'F':
+      if (!FrameCapture::parseFormat(optarg, &captureFormat)) {
+        fprintf(stderr, "Unknown capture format %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'e':
+      captureEvery = atoi(optarg);
+      if (captureEvery < 1) {
+        fprintf(stderr, "Bad capture interval %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'S':
+      if (!Upscaler::parse(optarg, &captureScale)) {
+        fprintf(stderr, "Unknown capture scale %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'H':
+      hashLogPath = optarg;
+      break;
+    case 'k':
+      frameskip = FramePacer::parseFrameskip(optarg);
+      if (frameskip < PACER_FRAMESKIP_AUTO) {
+        fprintf(stderr, "Bad frameskip %s\n", optarg);
+        exit(-1);
+      }
+      break;
+    case 'y':
+      if (!strcmp(optarg, "video")) {
+        sync = PACE_VIDEO;
+      } else if (!strcmp(optarg, "audio")) {
+        sync = PACE_AUDIO;
+      } else {
+        fprintf(stderr, "Unknown sync mode %s\n", optarg);
+        exit(-1);
+      }
+      break;
     case ':':
     case '?':
     default:
@@ -96,15 +210,60 @@ int main(int argc, char **argv) {
 
   char *rompath = argv[optind+0];
 
-  CPU cpu(vsync, displayTiles);
+  video.vsync = vsync;
+  video.debugViewEvery = displayTiles ? debugViewEvery : 0;
+  CPU cpu(video);
   cpu.loadRom(rompath);
-
-  if (debug) {
-    cpu.uninstall_sigint();
-    run_debugger(cpu);
+  cpu.pacer.setSpeed(speed);
+  cpu.pacer.reportStats = pacingStats;
+  cpu.pacer.setSync(sync);
+  cpu.pacer.setFrameskip(frameskip);
+  if (capturePath) {
+    // Nothing returns from here on; the program ends in exit(), so
+    // that's where the capture gets finished off. The emulator may
+    // still be running then, so the capture itself stays around.
+    static FrameCapture *capture;
+    capture = new FrameCapture(capturePath, captureFormat, captureEvery,
+                               captureScale);
+    atexit([]() { capture->finish(); });
+    cpu.capture = capture;
   }
-
-  while (1) {
-    cpu.tick();
+  if (video.backend == VIDEO_SHM) {
+    // Like the capture, the sink is never destroyed, so remove its
+    // shared memory object on the way out.
+    static ShmVideo *shm;
+    shm = static_cast<ShmVideo *>(cpu.video);
+    atexit([]() { shm->unlink(); });
   }
+  if (hashLogPath) {
+    // stdio flushes this on exit
+    FILE *hashLog = strcmp(hashLogPath, "-") ? fopen(hashLogPath, "w")
+      : stdout;
+    if (!hashLog) {
+      perror(hashLogPath);
+      exit(-1);
+    }
+    cpu.ppu->hashFrames(hashLog);
+  }
+  if (ppuThread) {
+    cpu.ppu->startWorker();
+  }
+
+  // The emulator runs on its own thread and hands finished frames to
+  // the video sink. With a window, this thread owns it (some
+  // platforms insist that's the main thread) and only ever shows the
+  // newest frame.
+  std::thread emulation([&cpu, debug]() {
+      if (debug) {
+        cpu.uninstall_sigint();
+        run_debugger(cpu);
+      }
+
+      while (1) {
+        cpu.run();
+      }
+    });
+  emulation.detach();
+
+  cpu.video->presentLoop();
 }
@@ -0,0 +1,248 @@
+#include <cstring>
+
+#include "tilecodec.hpp"
+
+static void put16(std::vector<uint8_t> &out, uint16_t v) {
+  out.push_back(v & 0xff);
+  out.push_back(v >> 8);
+}
+
+static void put32(std::vector<uint8_t> &out, uint32_t v) {
+  put16(out, v & 0xffff);
+  put16(out, v >> 16);
+}
+
+static uint32_t get(const uint8_t *in, int bytes) {
+  uint32_t v = 0;
+  for (int i = bytes - 1; i >= 0; i--) {
+    v = (v << 8) | in[i];
+  }
+  return v;
+}
+
+TileDeltaEncoder::TileDeltaEncoder(int width, int height)
+  : width(width), height(height),
+    cellsX(width / 8), cellsY(height / 8),
+    last(width * height), frames(0)
+{
+  memset(lastColors, 0, sizeof(lastColors));
+}
+
+void TileDeltaEncoder::header(uint32_t rateNum, uint32_t rateDen,
+                              std::vector<uint8_t> &out) {
+  out.insert(out.end(), TILE_MAGIC, TILE_MAGIC + sizeof(TILE_MAGIC));
+  put16(out, width);
+  put16(out, height);
+  put32(out, rateNum);
+  put32(out, rateDen);
+}
+
+void TileDeltaEncoder::frame(const uint8_t *shades,
+                             const DisplayPalette &palette,
+                             std::vector<uint8_t> &out) {
+  const bool key = !(frames++ % TILE_KEY_INTERVAL);
+
+  const uint8_t allShades[4] = {0, 1, 2, 3};
+  uint8_t rgba[16];
+  palette.convert(allShades, 4, PIXEL_RGBA8888, rgba);
+  uint8_t colors[12];
+  for (int s = 0; s < 4; s++) {
+    memcpy(colors + s*3, rgba + s*4, 3);
+  }
+
+  size_t frameAt = out.size();
+  put16(out, TILE_FRAME_SYNC);
+  put32(out, 0);
+  size_t flagsAt = out.size();
+  uint8_t flags = key ? TILE_FRAME_KEY : 0;
+  out.push_back(0);
+  if (key || memcmp(colors, lastColors, sizeof(colors))) {
+    flags |= TILE_FRAME_PALETTE;
+    out.insert(out.end(), colors, colors + sizeof(colors));
+    memcpy(lastColors, colors, sizeof(colors));
+  }
+
+  size_t bitmapAt = out.size();
+  if (!key) {
+    out.resize(out.size() + (cellsX * cellsY + 7) / 8, 0);
+  }
+  for (int cell = 0; cell < cellsX * cellsY; cell++) {
+    const int origin = (cell / cellsX) * 8 * width + (cell % cellsX) * 8;
+    bool changed = key;
+    for (int y = 0; (y < 8) && !changed; y++) {
+      changed = !!memcmp(shades + origin + y * width,
+                         last.data() + origin + y * width, 8);
+    }
+    if (!changed) {
+      continue;
+    }
+    if (!key) {
+      out[bitmapAt + cell / 8] |= 1 << (cell % 8);
+      flags |= TILE_FRAME_CELLS;
+    }
+    for (int y = 0; y < 8; y++) {
+      const uint8_t *row = shades + origin + y * width;
+      memcpy(last.data() + origin + y * width, row, 8);
+      for (int half = 0; half < 2; half++) {
+        const uint8_t *p = row + half * 4;
+        out.push_back(((p[0] & 3) << 6) | ((p[1] & 3) << 4) |
+                      ((p[2] & 3) << 2) | (p[3] & 3));
+      }
+    }
+  }
+  if (!key && !(flags & TILE_FRAME_CELLS)) {
+    // nothing changed, so no bitmap either
+    out.resize(bitmapAt);
+  }
+  out[flagsAt] = flags;
+  uint32_t length = out.size() - flagsAt;
+  for (int i = 0; i < 4; i++) {
+    out[frameAt + 2 + i] = (length >> (i * 8)) & 0xff;
+  }
+}
+
+bool TileDeltaDecoder::open(FILE *f) {
+  file = f;
+  uint8_t header[sizeof(TILE_MAGIC) + 12];
+  if ((fread(header, sizeof(header), 1, f) != 1) ||
+      memcmp(header, TILE_MAGIC, sizeof(TILE_MAGIC))) {
+    return 0;
+  }
+  const uint8_t *p = header + sizeof(TILE_MAGIC);
+  width = get(p, 2);
+  height = get(p + 2, 2);
+  rateNum = get(p + 4, 4);
+  rateDen = get(p + 8, 4);
+  if ((width % 8) || (height % 8) || !width || !height || !rateDen) {
+    return 0;
+  }
+  cellsX = width / 8;
+  cellsY = height / 8;
+  current.assign(width * height, 0);
+  memset(colors, 0, sizeof(colors));
+  resyncs = 0;
+  return 1;
+}
+
+size_t TileDeltaDecoder::keyLength() const {
+  return 1 + sizeof(colors) + cellsX * cellsY * TILE_CELL_BYTES;
+}
+
+bool TileDeltaDecoder::frame() {
+  std::vector<uint8_t> window(TILE_FRAME_HEADER);
+  if (fread(window.data(), window.size(), 1, file) != 1) {
+    return 0;
+  }
+  uint32_t length = get(&window[2], 4);
+  // No frame is longer than a delta frame with every cell changed.
+  if ((get(&window[0], 2) == TILE_FRAME_SYNC) && length &&
+      (length <= keyLength() + (cellsX * cellsY + 7) / 8)) {
+    body.resize(length);
+    if (fread(body.data(), length, 1, file) != 1) {
+      return 0;
+    }
+    if (decode(body.data(), length)) {
+      return 1;
+    }
+    // The next key frame could start anywhere after this sync word.
+    window.insert(window.end(), body.begin(), body.end());
+  }
+  resyncs++;
+  return findKey(window) && decode(body.data(), body.size());
+}
+
+bool TileDeltaDecoder::findKey(std::vector<uint8_t> &window) {
+  // A key frame's header and flags, which nothing else is likely to
+  // look like for all seven bytes.
+  const size_t need = TILE_FRAME_HEADER + 1;
+  const size_t length = keyLength();
+  size_t start = 1;
+  while (1) {
+    while (window.size() - start < need) {
+      int c = fgetc(file);
+      if (c == EOF) {
+        return 0;
+      }
+      window.push_back(c);
+    }
+    const uint8_t *p = &window[start];
+    if ((get(p, 2) == TILE_FRAME_SYNC) && (get(p + 2, 4) == length) &&
+        (p[TILE_FRAME_HEADER] == (TILE_FRAME_KEY | TILE_FRAME_PALETTE))) {
+      break;
+    }
+    start++;
+    if (start > 4096) {
+      window.erase(window.begin(), window.begin() + start);
+      start = 0;
+    }
+  }
+  // Whatever of the frame is already in the window, then the rest.
+  body.assign(window.begin() + start + TILE_FRAME_HEADER, window.end());
+  if (body.size() > length) {
+    // Frames after it were read too; put the window back to just
+    // after this one.
+    if (fseek(file, (long) length - (long) body.size(), SEEK_CUR)) {
+      return 0;
+    }
+    body.resize(length);
+  } else {
+    size_t have = body.size();
+    body.resize(length);
+    if (fread(body.data() + have, length - have, 1, file) != 1) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+bool TileDeltaDecoder::decode(const uint8_t *p, size_t n) {
+  const uint8_t *end = p + n;
+  const uint8_t flags = *p++;
+  const int nCells = cellsX * cellsY;
+  const uint8_t *newColors = NULL;
+  if (flags & TILE_FRAME_PALETTE) {
+    newColors = p;
+    p += sizeof(colors);
+  }
+  std::vector<uint8_t> bitmap((nCells + 7) / 8, 0xff);
+  int changed = nCells;
+  if (flags & TILE_FRAME_KEY) {
+    // every cell
+  } else if (flags & TILE_FRAME_CELLS) {
+    if (end - p < (long) bitmap.size()) {
+      return 0;
+    }
+    memcpy(bitmap.data(), p, bitmap.size());
+    p += bitmap.size();
+    changed = 0;
+    for (int cell = 0; cell < nCells; cell++) {
+      changed += (bitmap[cell / 8] >> (cell % 8)) & 1;
+    }
+  } else {
+    changed = 0;
+  }
+  if (end - p != (long) changed * TILE_CELL_BYTES) {
+    return 0;
+  }
+
+  if (newColors) {
+    memcpy(colors, newColors, sizeof(colors));
+    for (int s = 0; s < 4; s++) {
+      palette.setShade(s, colors[s*3], colors[s*3 + 1], colors[s*3 + 2]);
+    }
+  }
+  for (int cell = 0; changed && (cell < nCells); cell++) {
+    if (!(bitmap[cell / 8] & (1 << (cell % 8)))) {
+      continue;
+    }
+    const int origin = (cell / cellsX) * 8 * width + (cell % cellsX) * 8;
+    for (int i = 0; i < TILE_CELL_BYTES; i++) {
+      uint8_t *q = current.data() + origin + (i / 2) * width + (i % 2) * 4;
+      for (int x = 0; x < 4; x++) {
+        q[x] = (p[i] >> (6 - x*2)) & 3;
+      }
+    }
+    p += TILE_CELL_BYTES;
+  }
+  return 1;
+}
@@ -0,0 +1,97 @@
+#ifndef TILECODEC_H
+
+#define TILECODEC_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "displaypalette.hpp"
+
+// A lossless recording format for long sessions. Game Boy frames are
+// mostly the same as the one before, 8x8 cell by cell, so each frame
+// stores only the cells that changed, as packed 2-bit shades, plus the
+// four display colors whenever those change.
+//
+// File layout (all integers little-endian):
+//   header: "SPRWTILE", u16 width, u16 height, u32 rate numerator,
+//           u32 rate denominator
+//   frames, each: u16 TILE_FRAME_SYNC, u32 length of the rest, then
+//     u8 flags, then
+//     TILE_FRAME_PALETTE: 4 x RGB, the colors for shades 0-3
+//     TILE_FRAME_CELLS: a bitmap of changed cells (row-major, bit 0
+//       of the first byte first), then each changed cell
+//     TILE_FRAME_KEY: every cell, without a bitmap (and always with
+//       the palette)
+// A cell is 8 rows of 2 bytes, 4 pixels to a byte with the leftmost
+// in the high bits. A frame with no flags is the same as the last.
+//
+// The sync word and length let a decoder notice a damaged frame and
+// skip ahead to the next key frame, which it recognizes by its sync
+// word, exact length and flags.
+
+const char TILE_MAGIC[8] = {'S', 'P', 'R', 'W', 'T', 'I', 'L', 'E'};
+const uint8_t TILE_FRAME_PALETTE = 1<<0;
+const uint8_t TILE_FRAME_CELLS = 1<<1;
+const uint8_t TILE_FRAME_KEY = 1<<2;
+const uint16_t TILE_FRAME_SYNC = 0x7e5a;
+// sync word and length
+const int TILE_FRAME_HEADER = 6;
+
+const int TILE_CELL_BYTES = 16;
+// Store every cell this often (a minute), so after damage a decoder
+// loses at most about this many frames before it can pick up again.
+const int TILE_KEY_INTERVAL = 3600;
+
+class TileDeltaEncoder {
+public:
+  TileDeltaEncoder(int width, int height);
+
+  void header(uint32_t rateNum, uint32_t rateDen,
+              std::vector<uint8_t> &out);
+  // Append one frame of shades (0-3), as shown through `palette`.
+  void frame(const uint8_t *shades, const DisplayPalette &palette,
+             std::vector<uint8_t> &out);
+
+private:
+  int width, height;
+  int cellsX, cellsY;
+  std::vector<uint8_t> last;
+  uint8_t lastColors[12];
+  long frames;
+};
+
+class TileDeltaDecoder {
+public:
+  // Reads and checks the header. Returns 0 if this isn't a recording.
+  bool open(FILE *f);
+
+  int width, height;
+  uint32_t rateNum, rateDen;
+
+  // Read the next frame. Returns 0 at the end of the file (or at a
+  // truncated frame). shades() and palette are then the whole
+  // picture, not just what changed. A damaged frame, and everything
+  // up to the next key frame, is skipped (which can mean seeking back
+  // a little, so it needs a regular file).
+  bool frame();
+  const uint8_t *shades() const { return current.data(); }
+  DisplayPalette palette;
+  uint8_t colors[12]; // the same, as RGB
+  // how many times frames had to be skipped
+  long resyncs;
+
+private:
+  FILE *file;
+  int cellsX, cellsY;
+  std::vector<uint8_t> current;
+  std::vector<uint8_t> body;
+
+  size_t keyLength() const;
+  // Scan for the next key frame and read it into body.
+  bool findKey(std::vector<uint8_t> &window);
+  // Apply one frame's body, if it's consistent with its length.
+  bool decode(const uint8_t *p, size_t n);
+};
+
+#endif // #ifndef TILECODEC_H
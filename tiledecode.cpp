@@ -0,0 +1,216 @@
+// Turns a tile-delta recording (spearow --capture-format tiles) into
+// something ordinary tools can read: a Y4M stream, or one PNG per
+// frame.
+//
+//   spearow-decode recording out.y4m
+//   spearow-decode recording - > out.y4m
+//   spearow-decode recording frame%06d.png
+//
+// An optional last argument scales the output: 1x-8x (nearest
+// neighbour), scale2x, scale3x or epx.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "tilecodec.hpp"
+#include "upscale.hpp"
+
+static uint32_t crcTable[256];
+
+static void initCrc() {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    }
+    crcTable[n] = c;
+  }
+}
+
+static uint32_t crc(const uint8_t *data, size_t n) {
+  uint32_t c = 0xffffffff;
+  for (size_t i = 0; i < n; i++) {
+    c = crcTable[(c ^ data[i]) & 0xff] ^ (c >> 8);
+  }
+  return c ^ 0xffffffff;
+}
+
+static void putBig32(std::vector<uint8_t> &out, uint32_t v) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out.push_back(v >> shift);
+  }
+}
+
+static void pngChunk(FILE *f, const char *type,
+                     const std::vector<uint8_t> &data) {
+  std::vector<uint8_t> chunk;
+  putBig32(chunk, data.size());
+  chunk.insert(chunk.end(), type, type + 4);
+  chunk.insert(chunk.end(), data.begin(), data.end());
+  putBig32(chunk, crc(chunk.data() + 4, chunk.size() - 4));
+  fwrite(chunk.data(), chunk.size(), 1, f);
+}
+
+// A 2-bit paletted PNG: the shades are the palette indices already.
+// The image data is small enough to go in uncompressed ("stored")
+// deflate blocks, which saves pulling in zlib.
+static bool writePng(const char *path, const uint8_t *shades,
+                     int width, int height, const uint8_t *colors) {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    perror(path);
+    return 0;
+  }
+  static const uint8_t signature[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+  fwrite(signature, sizeof(signature), 1, f);
+
+  std::vector<uint8_t> ihdr;
+  putBig32(ihdr, width);
+  putBig32(ihdr, height);
+  const uint8_t rest[5] = {2, 3, 0, 0, 0}; // depth 2, paletted
+  ihdr.insert(ihdr.end(), rest, rest + sizeof(rest));
+  pngChunk(f, "IHDR", ihdr);
+
+  pngChunk(f, "PLTE", std::vector<uint8_t>(colors, colors + 12));
+
+  std::vector<uint8_t> raw;
+  for (int y = 0; y < height; y++) {
+    raw.push_back(0); // no filter
+    for (int x = 0; x < width; x += 4) {
+      const uint8_t *p = shades + y * width + x;
+      raw.push_back((p[0] << 6) | (p[1] << 4) | (p[2] << 2) | p[3]);
+    }
+  }
+  std::vector<uint8_t> zlib = {0x78, 0x01};
+  size_t pos = 0;
+  do {
+    size_t n = std::min(raw.size() - pos, (size_t) 0xffff);
+    bool last = (pos + n == raw.size());
+    zlib.push_back(last);
+    zlib.push_back(n & 0xff);
+    zlib.push_back(n >> 8);
+    zlib.push_back(~n & 0xff);
+    zlib.push_back((~n >> 8) & 0xff);
+    zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + n);
+    pos += n;
+  } while (pos < raw.size());
+  uint32_t a = 1, b = 0; // adler-32
+  for (size_t i = 0; i < raw.size(); i++) {
+    a = (a + raw[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  putBig32(zlib, (b << 16) | a);
+  pngChunk(f, "IDAT", zlib);
+
+  pngChunk(f, "IEND", std::vector<uint8_t>());
+  return !fclose(f);
+}
+
+static void writeY4mFrame(FILE *f, const uint8_t *shades, int n,
+                          const DisplayPalette &palette) {
+  std::vector<uint8_t> planes(n + n / 2);
+  palette.convert(shades, n, PIXEL_GRAY8, planes.data());
+  memset(planes.data() + n, 128, n / 2);
+  fputs("FRAME\n", f);
+  fwrite(planes.data(), planes.size(), 1, f);
+}
+
+static bool endsWith(const char *s, const char *suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return (n >= m) && !strcmp(s + n - m, suffix);
+}
+
+// The pattern is handed to snprintf, so it has to hold exactly one
+// plain integer conversion (%d, %06d and so on), and no others apart
+// from %%.
+static bool isFramePattern(const char *s) {
+  int conversions = 0;
+  while ((s = strchr(s, '%'))) {
+    s++;
+    if (*s == '%') {
+      s++;
+      continue;
+    }
+    s += strspn(s, "-+ 0#");
+    s += strspn(s, "0123456789");
+    if (*s == '.') {
+      s++;
+      s += strspn(s, "0123456789");
+    }
+    if (!*s || !strchr("diu", *s)) {
+      return 0;
+    }
+    s++;
+    conversions++;
+  }
+  return conversions == 1;
+}
+
+int main(int argc, char **argv) {
+  Upscaler upscaler;
+  if ((argc < 3) || (argc > 4) ||
+      ((argc == 4) && !Upscaler::parse(argv[3], &upscaler))) {
+    fprintf(stderr, "usage: %s recording (out.y4m | - | frame%%06d.png) "
+            "[1x-8x | scale2x | scale3x | epx]\n", argv[0]);
+    return -1;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  if (!in) {
+    perror(argv[1]);
+    return -1;
+  }
+  TileDeltaDecoder dec;
+  if (!dec.open(in)) {
+    fprintf(stderr, "%s isn't a tile recording\n", argv[1]);
+    return -1;
+  }
+
+  const char *outPath = argv[2];
+  bool y4m = !strcmp(outPath, "-") || endsWith(outPath, ".y4m");
+  if (!y4m && !isFramePattern(outPath)) {
+    fprintf(stderr, "PNG output needs one frame number in its name, "
+            "like frame%%06d.png\n");
+    return -1;
+  }
+  initCrc();
+  const int width = dec.width * upscaler.factor();
+  const int height = dec.height * upscaler.factor();
+  std::vector<uint8_t> scaled(width * height);
+
+  FILE *out = NULL;
+  if (y4m) {
+    out = strcmp(outPath, "-") ? fopen(outPath, "wb") : stdout;
+    if (!out) {
+      perror(outPath);
+      return -1;
+    }
+    fprintf(out, "YUV4MPEG2 W%d H%d F%u:%u Ip A1:1 C420jpeg\n",
+            width, height, dec.rateNum, dec.rateDen);
+  }
+
+  long frames = 0;
+  while (dec.frame()) {
+    upscaler.apply(dec.shades(), dec.width, dec.height, scaled.data());
+    if (y4m) {
+      writeY4mFrame(out, scaled.data(), width * height, dec.palette);
+    } else {
+      char path[4096];
+      snprintf(path, sizeof(path), outPath, (int) frames);
+      if (!writePng(path, scaled.data(), width, height, dec.colors)) {
+        return -1;
+      }
+    }
+    frames++;
+  }
+  if (out && (out != stdout)) {
+    fclose(out);
+  }
+  fprintf(stderr, "%ld frames\n", frames);
+  if (dec.resyncs) {
+    fprintf(stderr, "skipped damaged frames %ld times\n", dec.resyncs);
+  }
+  return 0;
+}
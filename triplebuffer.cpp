@@ -0,0 +1,30 @@
+#include "triplebuffer.hpp"
+
+TripleBuffer::TripleBuffer(size_t size)
+  : bufferSize(size), back(0), front(1), middle(2)
+{
+  for (int i = 0; i < 3; i++) {
+    buffers[i].assign(size, 0);
+  }
+}
+
+uint8_t *TripleBuffer::writeBuffer() {
+  return buffers[back].data();
+}
+
+void TripleBuffer::publish() {
+  // Release makes our writes visible to whoever picks this buffer up.
+  back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+}
+
+bool TripleBuffer::update() {
+  if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+    return 0;
+  }
+  front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+  return 1;
+}
+
+const uint8_t *TripleBuffer::readBuffer() const {
+  return buffers[front].data();
+}
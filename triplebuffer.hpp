@@ -0,0 +1,45 @@
+#ifndef TRIPLEBUFFER_H
+
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hands finished frames from one thread (the emulator) to another
+// (presentation) without either ever waiting on the other. The
+// producer always has a buffer to write into, the consumer always
+// has the newest complete one to read, and the third sits in the
+// middle holding whatever was published last. Publishing and picking
+// up just swap buffers with the middle one.
+class TripleBuffer {
+public:
+  TripleBuffer(size_t size);
+
+  size_t size() const { return bufferSize; }
+
+  // Producer: fill in writeBuffer(), then publish it. After
+  // publishing, writeBuffer() is a different buffer with stale
+  // contents.
+  uint8_t *writeBuffer();
+  void publish();
+
+  // Consumer: switch readBuffer() to the newest published buffer.
+  // Returns 0 if nothing has been published since the last update.
+  bool update();
+  const uint8_t *readBuffer() const;
+
+private:
+  // the middle index has this set when it holds something the
+  // consumer hasn't picked up yet
+  static const int FRESH = 4;
+
+  size_t bufferSize;
+  std::vector<uint8_t> buffers[3];
+  int back; // producer's
+  int front; // consumer's
+  std::atomic<int> middle;
+};
+
+#endif // #ifndef TRIPLEBUFFER_H
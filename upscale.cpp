@@ -0,0 +1,407 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "upscale.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UPSCALE_X86 1
+#include <immintrin.h>
+#endif
+
+// Nearest neighbour: widen each row once, then copy it down.
+
+static void nearest_row_scalar(const uint8_t *in, int width, int factor,
+                               uint8_t *out) {
+  for (int x = 0; x < width; x++) {
+    memset(out + x * factor, in[x], factor);
+  }
+}
+
+static void copy_rows(uint8_t *row, int bytes, int copies) {
+  for (int i = 1; i < copies; i++) {
+    memcpy(row + i * bytes, row, bytes);
+  }
+}
+
+static void nearest_scalar(const uint8_t *in, int width, int height,
+                           int factor, uint8_t *out) {
+  const int outWidth = width * factor;
+  for (int y = 0; y < height; y++) {
+    uint8_t *row = out + y * factor * outWidth;
+    nearest_row_scalar(in + y * width, width, factor, row);
+    copy_rows(row, outWidth, factor);
+  }
+}
+
+// Scale2x, for input columns [x0, x1). B is the row above, H the row
+// below, D and F the pixels left and right:
+//     B          E0 E1
+//   D E F   ->   E2 E3
+//     H
+// A corner takes its neighbours' color when they agree with each
+// other and the opposite neighbours don't.
+static void scale2x_row_scalar(const uint8_t *above, const uint8_t *row,
+                               const uint8_t *below, int width,
+                               int x0, int x1,
+                               uint8_t *out0, uint8_t *out1) {
+  for (int x = x0; x < x1; x++) {
+    uint8_t B = above[x], H = below[x], E = row[x];
+    uint8_t D = row[std::max(x - 1, 0)];
+    uint8_t F = row[std::min(x + 1, width - 1)];
+    uint8_t e0 = E, e1 = E, e2 = E, e3 = E;
+    if ((B != H) && (D != F)) {
+      e0 = (D == B) ? D : E;
+      e1 = (B == F) ? F : E;
+      e2 = (D == H) ? D : E;
+      e3 = (H == F) ? F : E;
+    }
+    out0[x*2] = e0;
+    out0[x*2 + 1] = e1;
+    out1[x*2] = e2;
+    out1[x*2 + 1] = e3;
+  }
+}
+
+// Scale3x, likewise, with the corners A, C, G and I as well:
+//   A B C        E0 E1 E2
+//   D E F   ->   E3 E4 E5
+//   G H I        E6 E7 E8
+static void scale3x_row_scalar(const uint8_t *above, const uint8_t *row,
+                               const uint8_t *below, int width,
+                               int x0, int x1, uint8_t *out0,
+                               uint8_t *out1, uint8_t *out2) {
+  for (int x = x0; x < x1; x++) {
+    int left = std::max(x - 1, 0), right = std::min(x + 1, width - 1);
+    uint8_t A = above[left], B = above[x], C = above[right];
+    uint8_t D = row[left], E = row[x], F = row[right];
+    uint8_t G = below[left], H = below[x], I = below[right];
+    uint8_t e[9] = {E, E, E, E, E, E, E, E, E};
+    if ((B != H) && (D != F)) {
+      e[0] = (D == B) ? D : E;
+      e[1] = (((D == B) && (E != C)) || ((B == F) && (E != A))) ? B : E;
+      e[2] = (B == F) ? F : E;
+      e[3] = (((D == B) && (E != G)) || ((D == H) && (E != A))) ? D : E;
+      e[5] = (((B == F) && (E != I)) || ((H == F) && (E != C))) ? F : E;
+      e[6] = (D == H) ? D : E;
+      e[7] = (((D == H) && (E != I)) || ((H == F) && (E != G))) ? H : E;
+      e[8] = (H == F) ? F : E;
+    }
+    memcpy(out0 + x*3, e, 3);
+    memcpy(out1 + x*3, e + 3, 3);
+    memcpy(out2 + x*3, e + 6, 3);
+  }
+}
+
+// Run a row function over the whole frame, clamping at the top and
+// bottom.
+typedef void (*scale2x_row_fn)(const uint8_t *, const uint8_t *,
+                               const uint8_t *, int, uint8_t *, uint8_t *);
+typedef void (*scale3x_row_fn)(const uint8_t *, const uint8_t *,
+                               const uint8_t *, int,
+                               uint8_t *, uint8_t *, uint8_t *);
+
+static void scale2x_frame(scale2x_row_fn rowFn, const uint8_t *in,
+                          int width, int height, uint8_t *out) {
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row = in + y * width;
+    uint8_t *out0 = out + y * 2 * (width * 2);
+    rowFn(row - (y > 0 ? width : 0), row,
+          row + (y < height - 1 ? width : 0), width,
+          out0, out0 + width * 2);
+  }
+}
+
+static void scale3x_frame(scale3x_row_fn rowFn, const uint8_t *in,
+                          int width, int height, uint8_t *out) {
+  for (int y = 0; y < height; y++) {
+    const uint8_t *row = in + y * width;
+    uint8_t *out0 = out + y * 3 * (width * 3);
+    rowFn(row - (y > 0 ? width : 0), row,
+          row + (y < height - 1 ? width : 0), width,
+          out0, out0 + width * 3, out0 + width * 6);
+  }
+}
+
+static void scale2x_whole_row_scalar(const uint8_t *above, const uint8_t *row,
+                                     const uint8_t *below, int width,
+                                     uint8_t *out0, uint8_t *out1) {
+  scale2x_row_scalar(above, row, below, width, 0, width, out0, out1);
+}
+
+static void scale3x_whole_row_scalar(const uint8_t *above, const uint8_t *row,
+                                     const uint8_t *below, int width,
+                                     uint8_t *out0, uint8_t *out1,
+                                     uint8_t *out2) {
+  scale3x_row_scalar(above, row, below, width, 0, width, out0, out1, out2);
+}
+
+static void scale2x_scalar(const uint8_t *in, int width, int height,
+                           uint8_t *out) {
+  scale2x_frame(scale2x_whole_row_scalar, in, width, height, out);
+}
+
+static void scale3x_scalar(const uint8_t *in, int width, int height,
+                           uint8_t *out) {
+  scale3x_frame(scale3x_whole_row_scalar, in, width, height, out);
+}
+
+#ifdef UPSCALE_X86
+
+// SSE2 does 16 pixels at a time. The first and last columns need
+// clamping, so they (and any leftover) go through the scalar code.
+
+__attribute__((target("sse2")))
+static inline __m128i blend(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+__attribute__((target("sse2")))
+static void nearest_sse2(const uint8_t *in, int width, int height,
+                         int factor, uint8_t *out) {
+  if ((factor != 2) && (factor != 4)) {
+    nearest_scalar(in, width, height, factor, out);
+    return;
+  }
+  const int outWidth = width * factor;
+  for (int y = 0; y < height; y++) {
+    const uint8_t *src = in + y * width;
+    uint8_t *row = out + y * factor * outWidth;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i p = _mm_loadu_si128((const __m128i *) (src + x));
+      __m128i lo = _mm_unpacklo_epi8(p, p);
+      __m128i hi = _mm_unpackhi_epi8(p, p);
+      if (factor == 2) {
+        _mm_storeu_si128((__m128i *) (row + x*2), lo);
+        _mm_storeu_si128((__m128i *) (row + x*2 + 16), hi);
+      } else {
+        __m128i *dst = (__m128i *) (row + x*4);
+        _mm_storeu_si128(dst, _mm_unpacklo_epi16(lo, lo));
+        _mm_storeu_si128(dst + 1, _mm_unpackhi_epi16(lo, lo));
+        _mm_storeu_si128(dst + 2, _mm_unpacklo_epi16(hi, hi));
+        _mm_storeu_si128(dst + 3, _mm_unpackhi_epi16(hi, hi));
+      }
+    }
+    nearest_row_scalar(src + x, width - x, factor, row + x * factor);
+    copy_rows(row, outWidth, factor);
+  }
+}
+
+__attribute__((target("sse2")))
+static void scale2x_row_sse2(const uint8_t *above, const uint8_t *row,
+                             const uint8_t *below, int width,
+                             uint8_t *out0, uint8_t *out1) {
+  const __m128i ones = _mm_set1_epi8(-1);
+  int x = 1;
+  for (; x + 17 <= width; x += 16) {
+    __m128i B = _mm_loadu_si128((const __m128i *) (above + x));
+    __m128i H = _mm_loadu_si128((const __m128i *) (below + x));
+    __m128i D = _mm_loadu_si128((const __m128i *) (row + x - 1));
+    __m128i E = _mm_loadu_si128((const __m128i *) (row + x));
+    __m128i F = _mm_loadu_si128((const __m128i *) (row + x + 1));
+    __m128i active = _mm_xor_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(B, H), _mm_cmpeq_epi8(D, F)), ones);
+    __m128i e0 = blend(_mm_and_si128(active, _mm_cmpeq_epi8(D, B)), D, E);
+    __m128i e1 = blend(_mm_and_si128(active, _mm_cmpeq_epi8(B, F)), F, E);
+    __m128i e2 = blend(_mm_and_si128(active, _mm_cmpeq_epi8(D, H)), D, E);
+    __m128i e3 = blend(_mm_and_si128(active, _mm_cmpeq_epi8(H, F)), F, E);
+    _mm_storeu_si128((__m128i *) (out0 + x*2), _mm_unpacklo_epi8(e0, e1));
+    _mm_storeu_si128((__m128i *) (out0 + x*2 + 16), _mm_unpackhi_epi8(e0, e1));
+    _mm_storeu_si128((__m128i *) (out1 + x*2), _mm_unpacklo_epi8(e2, e3));
+    _mm_storeu_si128((__m128i *) (out1 + x*2 + 16), _mm_unpackhi_epi8(e2, e3));
+  }
+  scale2x_row_scalar(above, row, below, width, 0, 1, out0, out1);
+  scale2x_row_scalar(above, row, below, width, x, width, out0, out1);
+}
+
+__attribute__((target("sse2")))
+static void scale2x_sse2(const uint8_t *in, int width, int height,
+                         uint8_t *out) {
+  scale2x_frame(scale2x_row_sse2, in, width, height, out);
+}
+
+// Tripling needs a byte shuffle to interleave three vectors, so it
+// waits for SSSE3. SHUFFLE3[v][k] picks, for output vector v, the
+// bytes that come from input k (0x80 gives zero).
+struct shuffle3_masks {
+  uint8_t m[3][3][16];
+  shuffle3_masks() {
+    for (int v = 0; v < 3; v++) {
+      for (int k = 0; k < 3; k++) {
+        for (int j = 0; j < 16; j++) {
+          int g = v * 16 + j;
+          m[v][k][j] = (g % 3 == k) ? g / 3 : 0x80;
+        }
+      }
+    }
+  }
+};
+static const shuffle3_masks SHUFFLE3;
+
+__attribute__((target("ssse3")))
+static inline void store3(uint8_t *out, __m128i a, __m128i b, __m128i c) {
+  const __m128i in[3] = {a, b, c};
+  for (int v = 0; v < 3; v++) {
+    __m128i result = _mm_setzero_si128();
+    for (int k = 0; k < 3; k++) {
+      __m128i mask = _mm_loadu_si128((const __m128i *) SHUFFLE3.m[v][k]);
+      result = _mm_or_si128(result, _mm_shuffle_epi8(in[k], mask));
+    }
+    _mm_storeu_si128((__m128i *) (out + v * 16), result);
+  }
+}
+
+__attribute__((target("ssse3")))
+static void nearest_ssse3(const uint8_t *in, int width, int height,
+                          int factor, uint8_t *out) {
+  if (factor != 3) {
+    nearest_sse2(in, width, height, factor, out);
+    return;
+  }
+  const int outWidth = width * 3;
+  for (int y = 0; y < height; y++) {
+    const uint8_t *src = in + y * width;
+    uint8_t *row = out + y * 3 * outWidth;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+      __m128i p = _mm_loadu_si128((const __m128i *) (src + x));
+      store3(row + x*3, p, p, p);
+    }
+    nearest_row_scalar(src + x, width - x, 3, row + x*3);
+    copy_rows(row, outWidth, 3);
+  }
+}
+
+__attribute__((target("ssse3")))
+static void scale3x_row_ssse3(const uint8_t *above, const uint8_t *row,
+                              const uint8_t *below, int width,
+                              uint8_t *out0, uint8_t *out1, uint8_t *out2) {
+  const __m128i ones = _mm_set1_epi8(-1);
+  int x = 1;
+  for (; x + 17 <= width; x += 16) {
+    __m128i A = _mm_loadu_si128((const __m128i *) (above + x - 1));
+    __m128i B = _mm_loadu_si128((const __m128i *) (above + x));
+    __m128i C = _mm_loadu_si128((const __m128i *) (above + x + 1));
+    __m128i D = _mm_loadu_si128((const __m128i *) (row + x - 1));
+    __m128i E = _mm_loadu_si128((const __m128i *) (row + x));
+    __m128i F = _mm_loadu_si128((const __m128i *) (row + x + 1));
+    __m128i G = _mm_loadu_si128((const __m128i *) (below + x - 1));
+    __m128i H = _mm_loadu_si128((const __m128i *) (below + x));
+    __m128i I = _mm_loadu_si128((const __m128i *) (below + x + 1));
+    __m128i active = _mm_xor_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(B, H), _mm_cmpeq_epi8(D, F)), ones);
+    __m128i DB = _mm_and_si128(active, _mm_cmpeq_epi8(D, B));
+    __m128i BF = _mm_and_si128(active, _mm_cmpeq_epi8(B, F));
+    __m128i DH = _mm_and_si128(active, _mm_cmpeq_epi8(D, H));
+    __m128i HF = _mm_and_si128(active, _mm_cmpeq_epi8(H, F));
+    // "E != X", as masks
+    __m128i nA = _mm_xor_si128(_mm_cmpeq_epi8(E, A), ones);
+    __m128i nC = _mm_xor_si128(_mm_cmpeq_epi8(E, C), ones);
+    __m128i nG = _mm_xor_si128(_mm_cmpeq_epi8(E, G), ones);
+    __m128i nI = _mm_xor_si128(_mm_cmpeq_epi8(E, I), ones);
+
+    __m128i e0 = blend(DB, D, E);
+    __m128i e1 = blend(_mm_or_si128(_mm_and_si128(DB, nC),
+                                     _mm_and_si128(BF, nA)), B, E);
+    __m128i e2 = blend(BF, F, E);
+    __m128i e3 = blend(_mm_or_si128(_mm_and_si128(DB, nG),
+                                     _mm_and_si128(DH, nA)), D, E);
+    __m128i e5 = blend(_mm_or_si128(_mm_and_si128(BF, nI),
+                                     _mm_and_si128(HF, nC)), F, E);
+    __m128i e6 = blend(DH, D, E);
+    __m128i e7 = blend(_mm_or_si128(_mm_and_si128(DH, nI),
+                                     _mm_and_si128(HF, nG)), H, E);
+    __m128i e8 = blend(HF, F, E);
+    store3(out0 + x*3, e0, e1, e2);
+    store3(out1 + x*3, e3, E, e5);
+    store3(out2 + x*3, e6, e7, e8);
+  }
+  scale3x_row_scalar(above, row, below, width, 0, 1, out0, out1, out2);
+  scale3x_row_scalar(above, row, below, width, x, width, out0, out1, out2);
+}
+
+__attribute__((target("ssse3")))
+static void scale3x_ssse3(const uint8_t *in, int width, int height,
+                          uint8_t *out) {
+  scale3x_frame(scale3x_row_ssse3, in, width, height, out);
+}
+
+#endif // #ifdef UPSCALE_X86
+
+std::vector<upscale_kernels> available_upscale_kernels() {
+  std::vector<upscale_kernels> out;
+  out.push_back({"scalar", nearest_scalar, scale2x_scalar, scale3x_scalar});
+#ifdef UPSCALE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse2")) {
+    out.push_back({"sse2", nearest_sse2, scale2x_sse2, scale3x_scalar});
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    out.push_back({"ssse3", nearest_ssse3, scale2x_sse2, scale3x_ssse3});
+  }
+#endif
+  return out;
+}
+
+const upscale_kernels &best_upscale_kernels() {
+  static const upscale_kernels best = available_upscale_kernels().back();
+  return best;
+}
+
+Upscaler::Upscaler(upscale_filter filter, int factor)
+  : filter(filter), kernels(&best_upscale_kernels())
+{
+  switch (filter) {
+  case UPSCALE_SCALE2X:
+  case UPSCALE_EPX:
+    scale = 2;
+    break;
+  case UPSCALE_SCALE3X:
+    scale = 3;
+    break;
+  case UPSCALE_NEAREST:
+  default:
+    scale = std::max(factor, 1);
+    break;
+  }
+}
+
+void Upscaler::apply(const uint8_t *in, int width, int height,
+                     uint8_t *out) const {
+  switch (filter) {
+  case UPSCALE_SCALE2X:
+  case UPSCALE_EPX:
+    kernels->scale2x(in, width, height, out);
+    break;
+  case UPSCALE_SCALE3X:
+    kernels->scale3x(in, width, height, out);
+    break;
+  case UPSCALE_NEAREST:
+  default:
+    if (scale == 1) {
+      memcpy(out, in, width * height);
+    } else {
+      kernels->nearest(in, width, height, scale, out);
+    }
+    break;
+  }
+}
+
+bool Upscaler::parse(const char *s, Upscaler *out) {
+  if (!strcmp(s, "scale2x")) {
+    *out = Upscaler(UPSCALE_SCALE2X);
+  } else if (!strcmp(s, "scale3x")) {
+    *out = Upscaler(UPSCALE_SCALE3X);
+  } else if (!strcmp(s, "epx")) {
+    *out = Upscaler(UPSCALE_EPX);
+  } else {
+    char *end;
+    long factor = strtol(s, &end, 10);
+    if ((end == s) || strcmp(end, "x") || (factor < 1) || (factor > 8)) {
+      return 0;
+    }
+    *out = Upscaler(UPSCALE_NEAREST, factor);
+  }
+  return 1;
+}
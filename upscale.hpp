@@ -0,0 +1,66 @@
+#ifndef UPSCALE_H
+
+#define UPSCALE_H
+
+#include <cstdint>
+#include <vector>
+
+// Pixel-art upscaling in software, for outputs that don't go through
+// GL (capture, mostly). These work on shades, one byte per pixel,
+// before they're turned into colors: that's a quarter of the data of
+// RGBA, and the Scale2x family only ever compares pixels for
+// equality, which shades are as good for as colors. Like the pixel
+// kernels, each has SIMD versions picked at runtime.
+
+// Scale each pixel up to a factor x factor block. out is
+// (width * factor) x (height * factor).
+typedef void (*upscale_nearest_fn)(const uint8_t *in, int width, int height,
+                                   int factor, uint8_t *out);
+// Scale2x / Scale3x (AdvMAME2x/3x). out is 2 or 3 times the size
+// each way. Pixels past the edge count as copies of the edge.
+typedef void (*upscale_fn)(const uint8_t *in, int width, int height,
+                           uint8_t *out);
+
+struct upscale_kernels {
+  const char *name;
+  upscale_nearest_fn nearest;
+  upscale_fn scale2x;
+  upscale_fn scale3x;
+};
+
+// Every version this build and this CPU support, scalar first.
+std::vector<upscale_kernels> available_upscale_kernels();
+
+// The best of those. Chosen the first time it's called.
+const upscale_kernels &best_upscale_kernels();
+
+enum upscale_filter {
+  UPSCALE_NEAREST,
+  UPSCALE_SCALE2X,
+  UPSCALE_SCALE3X,
+  // Eric's Pixel Expansion. It gives exactly the same picture as
+  // Scale2x, which is a rewrite of it, so it runs the same kernel.
+  UPSCALE_EPX
+};
+
+// A filter and scale picked once, e.g. from the command line.
+class Upscaler {
+public:
+  // factor only matters for UPSCALE_NEAREST.
+  Upscaler(upscale_filter filter = UPSCALE_NEAREST, int factor = 1);
+
+  int factor() const { return scale; }
+  // out is width * factor() by height * factor().
+  void apply(const uint8_t *in, int width, int height, uint8_t *out) const;
+
+  // Parse "1x" to "8x" (nearest neighbour), "scale2x", "scale3x" or
+  // "epx". Returns 0 if it's none of those.
+  static bool parse(const char *, Upscaler *);
+
+private:
+  upscale_filter filter;
+  int scale;
+  const upscale_kernels *kernels;
+};
+
+#endif // #ifndef UPSCALE_H
@@ -0,0 +1,66 @@
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "videosink.hpp"
+#include "screen.hpp"
+#include "shmvideo.hpp"
+
+// Frames go nowhere and no buttons are ever pressed.
+class NullVideo : public VideoSink {
+public:
+  void publishFrame(const uint8_t *shades) {}
+};
+
+VideoSink *VideoSink::create(CPU *cpu, const video_config &config) {
+  switch (config.backend) {
+  case VIDEO_GL:
+    return new Screen(cpu, config.vsync, config.debugViewEvery);
+  case VIDEO_SHM:
+    return new ShmVideo(config.shmName);
+  case VIDEO_NULL:
+  default:
+    return new NullVideo();
+  }
+}
+
+bool VideoSink::parseBackend(const char *s, video_backend *out) {
+  if (!strcmp(s, "null")) {
+    *out = VIDEO_NULL;
+  } else if (!strcmp(s, "gl")) {
+    *out = VIDEO_GL;
+  } else if (!strcmp(s, "shm")) {
+    *out = VIDEO_SHM;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+uint8_t VideoSink::getKeys(uint8_t inputFlags) {
+  return joypadBits(inputFlags, 0, 0);
+}
+
+void VideoSink::presentLoop() {
+  while (1) {
+    std::this_thread::sleep_for(std::chrono::hours(1));
+  }
+}
+
+uint8_t VideoSink::joypadBits(uint8_t inputFlags, uint8_t buttons,
+                              uint8_t directions) {
+  // COMPAT: I'm not sure what happens when both JOYPAD_DIRECTIONS and
+  // JOYPAD_BUTTONS bits are set low. This is just a guess.
+
+  // COMPAT: Unclear what the top nibble of this should be. Guessing
+  // it can be 0 for now.
+
+  uint8_t out = 0xf;
+  if (!(inputFlags & JOYPAD_DIRECTIONS)) {
+    out &= ~directions;
+  }
+  if (!(inputFlags & JOYPAD_BUTTONS)) {
+    out &= ~buttons;
+  }
+  return out;
+}
@@ -0,0 +1,77 @@
+#ifndef VIDEOSINK_H
+
+#define VIDEOSINK_H
+
+#include <cstdint>
+
+// Where finished frames go, and where joypad input comes from. Which
+// backend is decided when the CPU is constructed:
+//
+//   VIDEO_NULL: nothing. No window, no input; the core runs headless.
+//   VIDEO_GL:   a GLFW window (see screen.hpp).
+//   VIDEO_SHM:  a POSIX shared memory object, for another process to
+//               show frames from and write input to (see shmvideo.hpp).
+
+// joypad state is read through here too
+const uint8_t JOYPAD_DIRECTIONS = 1<<4; // port P14
+const uint8_t JOYPAD_BUTTONS = 1<<5; // port P15
+const uint8_t JOYPAD_RIGHT = 1<<0; // port P10
+const uint8_t JOYPAD_A = 1<<0; // port P10
+const uint8_t JOYPAD_LEFT = 1<<1; // port P11
+const uint8_t JOYPAD_B = 1<<1; // port P11
+const uint8_t JOYPAD_UP = 1<<2; // port P12
+const uint8_t JOYPAD_SELECT = 1<<2; // port P12
+const uint8_t JOYPAD_DOWN = 1<<3; // port P13
+const uint8_t JOYPAD_START = 1<<3; // port P13
+
+enum video_backend {
+  VIDEO_NULL,
+  VIDEO_GL,
+  VIDEO_SHM
+};
+
+const char *const VIDEO_SHM_DEFAULT_NAME = "/spearow";
+
+struct video_config {
+  video_backend backend = VIDEO_NULL;
+  // GL: wait for vertical sync when swapping
+  bool vsync = true;
+  // GL: show the debug window, refreshed every this many frames
+  int debugViewEvery = 0;
+  // SHM: name of the shared memory object
+  const char *shmName = VIDEO_SHM_DEFAULT_NAME;
+};
+
+class CPU;
+
+class VideoSink {
+public:
+  static VideoSink *create(CPU *cpu, const video_config &config);
+  // "null", "gl" or "shm". Returns 0 for anything else.
+  static bool parseBackend(const char *s, video_backend *out);
+
+  virtual ~VideoSink() {}
+
+  // Called from the emulation thread (or the PPU's worker) when a
+  // frame is finished, with SCREEN_WIDTH * SCREEN_HEIGHT shades.
+  // Never blocks.
+  virtual void publishFrame(const uint8_t *shades) = 0;
+  // Called from the emulation thread at every vblank.
+  virtual void vblank() {}
+
+  // The joypad, as the P1 register reads it with the given select
+  // bits. Safe to call from any thread.
+  virtual uint8_t getKeys(uint8_t inputFlags);
+
+  // The main thread ends up here once emulation is running on its
+  // own thread, and never comes back. By default there's nothing to
+  // do there.
+  virtual void presentLoop();
+
+protected:
+  // P1's low nibble, given which JOYPAD_* bits are held.
+  static uint8_t joypadBits(uint8_t inputFlags, uint8_t buttons,
+                            uint8_t directions);
+};
+
+#endif // #ifndef VIDEOSINK_H